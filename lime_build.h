@@ -13,10 +13,47 @@
 #include <sys/wait.h>
 #include <dirent.h>
 #include <glob.h>
+#include <fnmatch.h>
+#include <ctime>
 #include <chrono>
 #include <cstdlib>
 #include <cerrno>
 #include <fcntl.h>
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <algorithm>
+#include <coroutine>
+#include <optional>
+#include <exception>
+#include <type_traits>
+#include <spawn.h>
+#include <signal.h>
+#include <poll.h>
+#include <ftw.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <linux/fs.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <iterator>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace lime { class string; }
 
@@ -33,6 +70,12 @@ namespace lime {
 		SUCCESS,
 		ERRNO,
 		PATH_ABSOLUTE,
+		CMD_INVOKE_FAILED,
+		CMD_RETURNED_FAILURE,
+		SOCKET_FAILED,
+		PROTOCOL_INVALID,
+		EXECUTABLE_NOT_FOUND,
+		MODULE_GRAPH_INVALID,
 	}
 
 	[[noreturn]] inline void exit_program(int exit_code) noexcept {
@@ -57,6 +100,260 @@ namespace lime {
 	lime::string pwd()		       noexcept;
 	void cd(lime::string target_directory) noexcept;
 
+	// NOTE: Bumped by every successful lime::cd(), so that whoever caches the cwd knows when to look it up again.
+	inline uint64_t inner_cwd_generation = 0;
+
+	// NOTE: Always-on counters for lime's own overhead. Every thread counts into its own thread_local block,
+	// so counting is a plain add, no locked instructions and no cache line ping-pong between threads.
+	// The block is constant-initialized and trivially destructible, so touching it needs no TLS init guard.
+	// It gets registered in a global list on a thread's first count (the only branch on the hot path), and its counts
+	// are folded into the totals when the thread exits, so nothing gets lost.
+	// See lime::print_stats() and lime::consume_stats_args() further down.
+	enum class counter_t : uint8_t {
+		STAT,
+		READLINK,
+		GETCWD,
+		CHDIR,
+		GLOB,
+		MKDIR,
+		PATH_PARSES,
+		STRING_BYTES_ALLOCATED,		// NOTE: Heap buffers only, strings that fit into the small string buffer don't allocate.
+		SPAWNS,
+		WAIT_NANOSECONDS,		// NOTE: Time spent blocked on child processes (their exit or their output).
+		COUNT
+	};
+
+	struct inner_thread_counters {
+		// NOTE: Atomic only so that the totals can be read from another thread without UB.
+		// Relaxed loads and stores of a u64 are plain movs, the owning thread is the only writer.
+		std::atomic<uint64_t> values[(size_t)counter_t::COUNT] { };
+		bool registered = false;
+	};
+
+	struct inner_counter_registry {
+		std::mutex mutex;
+		std::vector<inner_thread_counters*> live;
+		uint64_t retired[(size_t)counter_t::COUNT] { };
+	};
+
+	// NOTE: Leaked on purpose, it has to outlive every thread_local and every atexit handler.
+	inline inner_counter_registry& inner_get_counter_registry() noexcept {
+		static inner_counter_registry *registry = new inner_counter_registry;
+		return *registry;
+	}
+
+	constinit inline thread_local inner_thread_counters inner_counters;
+
+	// NOTE: Only exists for its destructor, which folds the thread's counts into the totals when the thread exits.
+	// Counts made by other thread_local destructors after it ran are dropped.
+	struct inner_thread_counters_retirer {
+		~inner_thread_counters_retirer() noexcept {
+			inner_counter_registry &registry = inner_get_counter_registry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			for (size_t i = 0; i < (size_t)counter_t::COUNT; i++) {
+				registry.retired[i] += inner_counters.values[i].load(std::memory_order_relaxed);
+				inner_counters.values[i].store(0, std::memory_order_relaxed);
+			}
+			registry.live.erase(std::find(registry.live.begin(), registry.live.end(), &inner_counters));
+		}
+	};
+
+	// NOTE: Cold path, runs once per thread. The retirer's destructor gets hooked up the first time control passes through here.
+	__attribute__((noinline, cold)) inline void inner_register_thread_counters() noexcept {
+		static thread_local inner_thread_counters_retirer retirer;
+		(void)retirer;
+		inner_counter_registry &registry = inner_get_counter_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.live.push_back(&inner_counters);
+		inner_counters.registered = true;
+	}
+
+	inline void inner_count(counter_t counter, uint64_t amount = 1) noexcept {
+		if (!inner_counters.registered) { inner_register_thread_counters(); }
+		std::atomic<uint64_t> &value = inner_counters.values[(size_t)counter];
+		value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// NOTE: Summed over all threads, the ones that are still running and the ones that already exited.
+	inline uint64_t get_counter(counter_t counter) noexcept {
+		inner_counter_registry &registry = inner_get_counter_registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		uint64_t result = registry.retired[(size_t)counter];
+		for (const inner_thread_counters *counters : registry.live) { result += counters->values[(size_t)counter].load(std::memory_order_relaxed); }
+		return result;
+	}
+
+	inline uint64_t inner_monotonic_nanoseconds() noexcept {
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	}
+
+	// NOTE: Roughly when the build script started, used for the driver time in the stats.
+	inline const uint64_t inner_program_start_nanoseconds = inner_monotonic_nanoseconds();
+
+	// NOTE: Put one of these around anything that blocks on children.
+	struct inner_wait_timer {
+		uint64_t start = inner_monotonic_nanoseconds();
+
+		~inner_wait_timer() noexcept { inner_count(counter_t::WAIT_NANOSECONDS, inner_monotonic_nanoseconds() - start); }
+	};
+
+	inline int inner_stat(const char *path, struct stat *stat_buf) noexcept {
+		inner_count(counter_t::STAT);
+		return stat(path, stat_buf);
+	}
+
+	inline int inner_fstat(int fd, struct stat *stat_buf) noexcept {
+		inner_count(counter_t::STAT);
+		return fstat(fd, stat_buf);
+	}
+
+	inline int inner_fstatat(int directory_fd, const char *path, struct stat *stat_buf, int flags) noexcept {
+		inner_count(counter_t::STAT);
+		return fstatat(directory_fd, path, stat_buf, flags);
+	}
+
+	// NOTE: Byte-search kernels for everything that tokenizes: path parsing, string splitting, command lines and the source scanners.
+	// The multi-needle search goes 32 bytes at a time with AVX2, 16 with SSE2, or one at a time otherwise.
+	// Which one is decided at runtime on the first call, so the same binary runs everywhere and still uses AVX2
+	// when it's there. Single-byte searches just go through memchr, glibc already does the same dispatching for that.
+	using inner_find_any_of_t = const char* (*)(const char *head, const char *end, char a, char b, char c, char d) noexcept;
+
+	inline const char* inner_find_any_of_scalar(const char *head, const char *end, char a, char b, char c, char d) noexcept {
+		for (; head < end; head++) {
+			if (*head == a || *head == b || *head == c || *head == d) { return head; }
+		}
+		return end;
+	}
+
+#ifdef __SSE2__
+	inline const char* inner_find_any_of_sse2(const char *head, const char *end, char a, char b, char c, char d) noexcept {
+		const __m128i needle_a = _mm_set1_epi8(a);
+		const __m128i needle_b = _mm_set1_epi8(b);
+		const __m128i needle_c = _mm_set1_epi8(c);
+		const __m128i needle_d = _mm_set1_epi8(d);
+		for (; end - head >= 16; head += 16) {
+			const __m128i chunk = _mm_loadu_si128((const __m128i*)head);
+			const __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, needle_a), _mm_cmpeq_epi8(chunk, needle_b)),
+								_mm_or_si128(_mm_cmpeq_epi8(chunk, needle_c), _mm_cmpeq_epi8(chunk, needle_d)));
+			const int mask = _mm_movemask_epi8(matches);
+			if (mask != 0) { return head + __builtin_ctz(mask); }
+		}
+		return inner_find_any_of_scalar(head, end, a, b, c, d);
+	}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((target("avx2")))
+	inline const char* inner_find_any_of_avx2(const char *head, const char *end, char a, char b, char c, char d) noexcept {
+		const __m256i needle_a = _mm256_set1_epi8(a);
+		const __m256i needle_b = _mm256_set1_epi8(b);
+		const __m256i needle_c = _mm256_set1_epi8(c);
+		const __m256i needle_d = _mm256_set1_epi8(d);
+		for (; end - head >= 32; head += 32) {
+			const __m256i chunk = _mm256_loadu_si256((const __m256i*)head);
+			const __m256i matches = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, needle_a), _mm256_cmpeq_epi8(chunk, needle_b)),
+								_mm256_or_si256(_mm256_cmpeq_epi8(chunk, needle_c), _mm256_cmpeq_epi8(chunk, needle_d)));
+			const unsigned int mask = _mm256_movemask_epi8(matches);
+			if (mask != 0) { return head + __builtin_ctz(mask); }
+		}
+		return inner_find_any_of_scalar(head, end, a, b, c, d);
+	}
+#endif
+
+	inline const char* inner_find_any_of_resolve(const char *head, const char *end, char a, char b, char c, char d) noexcept;
+
+	// NOTE: Starts out pointing at the resolver, which swaps the real kernel in on the first call.
+	// That way it's constant-initialized and works even from static initializers.
+	inline std::atomic<inner_find_any_of_t> inner_find_any_of_kernel { inner_find_any_of_resolve };
+
+	inline const char* inner_find_any_of_resolve(const char *head, const char *end, char a, char b, char c, char d) noexcept {
+		inner_find_any_of_t kernel = inner_find_any_of_scalar;
+#ifdef __SSE2__
+		kernel = inner_find_any_of_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) { kernel = inner_find_any_of_avx2; }
+#endif
+		inner_find_any_of_kernel.store(kernel, std::memory_order_relaxed);
+		return kernel(head, end, a, b, c, d);
+	}
+
+	// NOTE: Returns a pointer to the first byte in [head, end) that is one of the four needles, or end if there isn't one.
+	// Pass the same needle more than once if you need fewer than four.
+	inline const char* inner_find_any_of(const char *head, const char *end, char a, char b, char c, char d) noexcept {
+		return inner_find_any_of_kernel.load(std::memory_order_relaxed)(head, end, a, b, c, d);
+	}
+
+	inline const char* inner_find_byte(const char *head, const char *end, char needle) noexcept {
+		const char *result = (const char*)std::memchr(head, needle, end - head);
+		return result == nullptr ? end : result;
+	}
+
+	// NOTE: Splits input along the delimiter into views of input, nothing gets copied. Empty pieces are kept,
+	// so there's always one more piece than there are delimiters. An empty delimiter gives back input as one piece.
+	inline void inner_split_views(std::string_view input, std::string_view delimiter, std::vector<std::string_view> &result) noexcept {
+		result.clear();
+		if (delimiter.empty()) { result.push_back(input); return; }
+
+		const char *head = input.data();
+		const char *const end = input.data() + input.size();
+		const char *piece_start = head;
+		while ((size_t)(end - head) >= delimiter.size()) {
+			head = inner_find_byte(head, end - (delimiter.size() - 1), delimiter[0]);
+			if (head == end - (delimiter.size() - 1)) { break; }
+			if (std::memcmp(head + 1, delimiter.data() + 1, delimiter.size() - 1) != 0) { head++; continue; }
+			result.emplace_back(piece_start, head - piece_start);
+			head += delimiter.size();
+			piece_start = head;
+		}
+		result.emplace_back(piece_start, end - piece_start);
+	}
+
+	// NOTE: Splits a command line into arguments along the spaces. Double quotes group everything inside of them
+	// into one argument, the quotes themselves don't end up in the argument.
+	// Arguments without quotes are views into cmdline. Arguments with quotes need the quotes taken out, so they're written
+	// into unquote_buffer and the views point in there. The buffer gets reserved up front for the worst case,
+	// so it never reallocates and the views stay valid for as long as the buffer does.
+	inline void inner_tokenize_command_line(std::string_view cmdline, std::vector<std::string_view> &result, std::string &unquote_buffer) noexcept {
+		result.clear();
+		unquote_buffer.clear();
+		unquote_buffer.reserve(cmdline.size());
+
+		const char *head = cmdline.data();
+		const char *const end = cmdline.data() + cmdline.size();
+		while (true) {
+			while (head < end && *head == ' ') { head++; }
+			if (head == end) { return; }
+
+			const char *const arg_start = head;
+			head = inner_find_any_of(head, end, ' ', '\"', ' ', '\"');
+			if (head == end || *head == ' ') {
+				result.emplace_back(arg_start, head - arg_start);
+				continue;
+			}
+
+			const size_t buffer_start = unquote_buffer.size();
+			unquote_buffer.append(arg_start, head);
+			bool inside_quotes = false;
+			while (head < end) {
+				if (*head == '\"') {
+					inside_quotes = !inside_quotes;
+					head++;
+					continue;
+				}
+				if (*head == ' ' && !inside_quotes) { break; }
+
+				const char *next = inside_quotes ? inner_find_byte(head, end, '\"') : inner_find_any_of(head, end, ' ', '\"', ' ', '\"');
+				unquote_buffer.append(head, next);
+				head = next;
+			}
+			result.emplace_back(unquote_buffer.data() + buffer_start, unquote_buffer.size() - buffer_start);
+		}
+	}
+
 	class string : private std::string {
 
 		// NOTE: Path handling. lime::strings don't handle paths themselves, they always construct a path
@@ -69,29 +366,24 @@ namespace lime {
 		class path {
 
 			// NOTE: The way we do path parsing is dead-simple. Split along the slashes.
-			void parse_inner(std::vector<std::string> &result, const char &character) const noexcept {
-				switch (character) {
-				case '\\':
-				case '/':
-					result.push_back(std::string());
-					break;
-				default: 
-					*(result.end() - 1) += character;
-					break;
-				}
-			}
-
-			std::vector<std::string> parse(const lime::string &input, error_t &error) const noexcept {
+			// The separators are found with the SIMD kernels and every element gets appended in one go,
+			// instead of going through the input character by character.
+			std::vector<std::string> parse_inner(const char *head, const char *end, error_t &error) const noexcept {
 				error = error_t::SUCCESS;
+				inner_count(counter_t::PATH_PARSES);
 
 				std::vector<std::string> result;
 
-				result.push_back(std::string());
-				for (const char &character : input) { parse_inner(result, character); }
-				if (result.last()->size() == 0) { result.pop_back(); }
+				while (true) {
+					const char *separator = inner_find_any_of(head, end, '/', '\\', '/', '\\');
+					result.emplace_back(head, separator);
+					if (separator == end) { break; }
+					head = separator + 1;
+				}
+				if (result.back().empty()) { result.pop_back(); }
 
 				for (size_t i = 1; i < result.size(); i++) {
-					if (element.empty()) {
+					if (result[i].empty()) {
 						error = error_t::PATH_INVALID;
 						return std::vector<std::string>();
 					}
@@ -100,23 +392,12 @@ namespace lime {
 				return result;
 			}
 
-			std::vector<std::string> parse(const char *input, error_t &error) const noexcept {
-				error = error_t::SUCCESS;
-
-				std::vector<std::string> result;
-
-				result.push_back(std::string());
-				for (; *input != '\0'; input++) { parse_inner(result, *input); }
-				if (result.last()->size() == 0) { result.pop_back(); }
-
-				for (size_t i = 1; i < result.size(); i++) {
-					if (element.empty()) {
-						error = error_t::PATH_INVALID;
-						return std::vector<std::string>();
-					}
-				}
+			std::vector<std::string> parse(const lime::string &input, error_t &error) const noexcept {
+				return parse_inner(input.c_str(), input.c_str() + input.length(), error);
+			}
 
-				return result;
+			std::vector<std::string> parse(const char *input, error_t &error) const noexcept {
+				return parse_inner(input, input + std::strlen(input), error);
 			}
 
 			std::vector<std::string> heirarchy;
@@ -231,6 +512,7 @@ namespace lime {
 				if (is_already_absolute) { return *this; }
 
 				char cwd[PATH_MAX + 1];	// NOTE: +1 because of trailing NUL, necessary says stackoverflow comment
+				inner_count(counter_t::GETCWD);
 				if (getcwd(cwd, sizeof(cwd)) == nullptr) {
 					error = error_t::ERRNO;
 					return path();
@@ -263,6 +545,7 @@ namespace lime {
 						char *buffer_end = buffer + sizeof(buffer);
 
 						while (true) {
+							inner_count(counter_t::READLINK);
 							ssize_t bytes_read = readlink(result_string.c_str(), buffer_head, buffer_end - buffer_head);
 
 							if (bytes_read == 0) { break; }
@@ -391,7 +674,7 @@ namespace lime {
 
 				struct stat stat_buf;
 
-				if (stat(this->to_std_string().c_str(), &stat_buf) < 0) {
+				if (inner_stat(this->to_std_string().c_str(), &stat_buf) < 0) {
 					// TODO: You should probably not use this + override in your library, in case the user wants it
 					// disabled for whatever valid reason he might have. Probably add a define at the top or something
 					// where the user can disable those global const char * operator + overrides.
@@ -419,20 +702,13 @@ namespace lime {
 
 		string(const path &path) noexcept : std::string(path.to_std_string()) { }
 
-		template <typename T>
-		std::vector<lime::string> inner_split(T delimiter, size_t delimiter_length) const noexcept {
-			std::vector<lime::string> result;
-
-			size_t last_delimiter_index = 0;
-			size_t next_delimiter_index = 0;
-			while ((next_delimiter_index = find(delimiter, next_delimiter_index)) != std::string::npos) {
-				result.push_back(substr(last_delimiter_index + delimiter_length,
-							next_delimiter_index - (last_delimiter_index + delimiter_length)));
-				last_delimiter_index = next_delimiter_index;
-			}
-
-			result.push_back(substr(last_delimiter_index + delimiter_length));
+		std::vector<lime::string> inner_split(std::string_view delimiter) const noexcept {
+			std::vector<std::string_view> pieces;
+			inner_split_views(std::string_view(data(), length()), delimiter, pieces);
 
+			std::vector<lime::string> result;
+			result.reserve(pieces.size());
+			for (std::string_view piece : pieces) { result.push_back(inner_counted(std::string(piece))); }
 			return result;
 		}
 
@@ -455,24 +731,62 @@ namespace lime {
 			return result;
 		}
 
+		// NOTE: For the stats. Call after anything that might have (re)allocated the buffer, with the capacity from before.
+		void inner_count_allocation(size_t previous_capacity) const noexcept {
+			if (capacity() != previous_capacity && capacity() > std::string().capacity()) { inner_count(counter_t::STRING_BYTES_ALLOCATED, capacity() + 1); }
+		}
+
+		// NOTE: For results that were built in a temporary std::string, moving them in doesn't allocate again.
+		static lime::string inner_counted(std::string &&std_string) noexcept {
+			lime::string result(std::move(std_string));
+			result.inner_count_allocation(0);
+			return result;
+		}
+
 	public:
 		static constexpr size_t npos = std::string::npos;
 
 		string() noexcept = default;
 
-		string(const char *raw_str) noexcept : std::string(raw_str) { }
+		string(const char *raw_str) noexcept : std::string(raw_str) { inner_count_allocation(0); }
 
-		string(const std::string& std_string) noexcept : std::string(std_string) { }
+		string(const std::string& std_string) noexcept : std::string(std_string) { inner_count_allocation(0); }
 		string(std::string&& std_string)      noexcept : std::string(std::move(std_string)) { }
 
-		lime::string operator+(const lime::string& right) const noexcept { return lime::string(*(const std::string*)this + *(const std::string*)&right); }
-		lime::string& operator+=(const lime::string& right) noexcept { std::string::operator+=(*(const std::string*)&right); return *this; }
+		string(const lime::string &other) noexcept : std::string(other) { inner_count_allocation(0); }
+		string(lime::string &&other) noexcept = default;
+
+		lime::string& operator=(const lime::string &right) noexcept {
+			const size_t previous_capacity = capacity();
+			std::string::operator=(right);
+			inner_count_allocation(previous_capacity);
+			return *this;
+		}
+		lime::string& operator=(lime::string &&right) noexcept = default;
+
+		lime::string operator+(const lime::string& right) const noexcept { return inner_counted(*(const std::string*)this + *(const std::string*)&right); }
+		lime::string& operator+=(const lime::string& right) noexcept {
+			const size_t previous_capacity = capacity();
+			std::string::operator+=(*(const std::string*)&right);
+			inner_count_allocation(previous_capacity);
+			return *this;
+		}
 
-		lime::string operator+(const char *raw_str) const noexcept { return lime::string(*(const std::string*)this + raw_str); }
-		lime::string& operator+=(const char *raw_str) noexcept { std::string::operator+=(raw_str); return *this; }
+		lime::string operator+(const char *raw_str) const noexcept { return inner_counted(*(const std::string*)this + raw_str); }
+		lime::string& operator+=(const char *raw_str) noexcept {
+			const size_t previous_capacity = capacity();
+			std::string::operator+=(raw_str);
+			inner_count_allocation(previous_capacity);
+			return *this;
+		}
 
-		lime::string operator+(char character) const noexcept { return lime::string(*(const std::string*)this + character); }
-		lime::string& operator+=(char character) noexcept { std::string::operator+=(character); return *this; }
+		lime::string operator+(char character) const noexcept { return inner_counted(*(const std::string*)this + character); }
+		lime::string& operator+=(char character) noexcept {
+			const size_t previous_capacity = capacity();
+			std::string::operator+=(character);
+			inner_count_allocation(previous_capacity);
+			return *this;
+		}
 
 		lime::string operator/(const lime::string& right) const noexcept {
 			return this->inner_concatinate(right);
@@ -487,11 +801,12 @@ namespace lime {
 			return (*this = operator/(raw_str));
 		}
 
+		// NOTE: Compared in place, to_std_string() would copy both sides first.
 		bool operator==(const lime::string &other) const noexcept {
-			return to_std_string() == other.to_std_string();
+			return *(const std::string*)this == *(const std::string*)&other;
 		}
 		bool operator==(const char *other) const noexcept {
-			return to_std_string() == other;
+			return *(const std::string*)this == other;
 		}
 
 		std::string to_std_string() const noexcept {
@@ -512,33 +827,40 @@ namespace lime {
 
 		lime::string substr(size_t index, size_t substr_length) const noexcept {
 			if (index >= length() || substr_length > length() - index) { lime::error("substr(index, substr_length) was called with out-of-bounds arguments"); exit_program(1); }
-			return lime::string(std::string::substr(index, substr_length));
+			return inner_counted(std::string::substr(index, substr_length));
 		}
 		lime::string substr(size_t index) const noexcept {
 			if (index >= length()) { lime::error("substr(index) was called with out-of-bounds arguments"); exit_program(1); }
-			return lime::string(std::string::substr(index));
+			return inner_counted(std::string::substr(index));
 		}
 
-		std::vector<lime::string> split(const char *delimiter)         const noexcept { return inner_split(delimiter, std::strlen(delimiter)); }
-		std::vector<lime::string> split(char delimiter)                const noexcept { return inner_split(delimiter, 1); }
-		std::vector<lime::string> split(const lime::string& delimiter) const noexcept { return inner_split(delimiter.c_str(), delimiter.length()); }
+		// NOTE: Empty pieces are kept, "a,,b" split along ',' is "a", "", "b".
+		std::vector<lime::string> split(const char *delimiter)         const noexcept { return inner_split(delimiter); }
+		std::vector<lime::string> split(char delimiter)                const noexcept { return inner_split(std::string_view(&delimiter, 1)); }
+		std::vector<lime::string> split(const lime::string& delimiter) const noexcept { return inner_split(std::string_view(delimiter.c_str(), delimiter.length())); }
 
 		lime::string insert(size_t index, const char *string) const noexcept {
 			if (index > length()) { lime::error("insert(index, string) was called with out-of-bounds arguments"); exit_program(1); }
 			lime::string result = *this;
+			const size_t previous_capacity = result.capacity();
 			result.std::string::insert(index, string);
+			result.inner_count_allocation(previous_capacity);
 			return result;
 		}
 		lime::string insert(size_t index, char character) const noexcept {
 			if (index > length()) { lime::error("insert(index, character) was called with out-of-bounds arguments"); exit_program(1); }
 			lime::string result = *this;
+			const size_t previous_capacity = result.capacity();
 			result.std::string::insert(index, &character, 1);
+			result.inner_count_allocation(previous_capacity);
 			return result;
 		}
 		lime::string insert(size_t index, const lime::string& string) const noexcept {
 			if (index > length()) { lime::error("insert(index, string) was called with out-of-bounds arguments"); exit_program(1); }
 			lime::string result = *this;
+			const size_t previous_capacity = result.capacity();
 			result.std::string::insert(index, string.c_str(), string.length());
+			result.inner_count_allocation(previous_capacity);
 			return result;
 		}
 
@@ -587,7 +909,7 @@ namespace lime {
 			if (!file_exists()) { return false; }
 
 			struct stat stat_buf;
-			if (stat(c_str(), &stat_buf) < 0) {
+			if (inner_stat(c_str(), &stat_buf) < 0) {
 				lime::error("lime::is_existing_directory() failed, stat failed, general failure");
 				exit_program(1);
 			}
@@ -716,6 +1038,7 @@ namespace lime {
 
 	lime::string pwd() noexcept {
 		char buffer[PATH_MAX + 1];	// NOTE: +1 because NUL character
+		inner_count(counter_t::GETCWD);
 		if (getcwd(buffer, sizeof(buffer)) == nullptr) {
 			lime::bug("pwd failed, getcwd failed, unknown error");
 			lime::exit_program(EXIT_FAILURE);
@@ -726,6 +1049,7 @@ namespace lime {
 	void cd(lime::string new_directory, error_t &error) noexcept {
 		error = error_t::SUCCESS;
 
+		inner_count(counter_t::CHDIR);
 		if (chdir(new_directory.c_str()) < 0) {
 			switch (errno) {
 			case ENOTDIR:
@@ -737,6 +1061,7 @@ namespace lime {
 				lime::exit_program(EXIT_FAILURE);
 			}
 		}
+		inner_cwd_generation++;
 	}
 
 	template <typename functor_t>
@@ -781,64 +1106,530 @@ namespace lime {
 		return false;
 	}
 
-	// TODO: FROM HERE
-	inline void inner_execute_command(const lime::string &cmdline, error_t &error) noexcept {
+	// NOTE: The spawn server is a tiny helper process, forked off by start_spawn_server() before the driver's heap grows.
+	// Once it's running, every command is spawned by it instead of by the driver, so the cost of a spawn stays the same
+	// no matter how much memory the driver has mapped, and the driver never gets stopped by a vfork.
+	// The driver sends one request per spawn with the argv, the environment and the cwd in it,
+	// and the child's stdin, stdout and stderr passed along as SCM_RIGHTS.
+	// The server answers with a SPAWNED reply right away and with an EXITED reply once the child is gone,
+	// so any number of spawns can be in flight at once.
+	// The server only ever lives as long as the driver, it exits as soon as its end of the socketpair hangs up.
+	// Every request starts with its total size. A SOCK_SEQPACKET message has to fit into the socket's send buffer,
+	// which the kernel caps at net.core.wmem_max (about 208 KB by default), so bigger requests are sent as several messages.
+	struct inner_spawn_reply {
+		enum : uint8_t { SPAWNED, EXITED } type;
+		pid_t pid;		// NOTE: -1 if the spawn failed.
+		int value;		// NOTE: errno of the failed spawn for SPAWNED, exit code for EXITED.
+	};
+
+	// NOTE: Upper bound on the size of a spawn request, big enough for multi-megabyte link lines.
+	constexpr size_t SPAWN_SERVER_MAX_REQUEST_SIZE = 8 * 1024 * 1024;
+
+	// NOTE: Request flag, the child becomes the leader of a new process group.
+	constexpr uint32_t SPAWN_NEW_PROCESS_GROUP = 1 << 0;
+
+	// NOTE: -1 while there's no spawn server, everything gets spawned directly in that case.
+	inline int inner_spawn_server_fd = -1;
+	// NOTE: How much of a request goes into one message, half of the send buffer the kernel actually gave us.
+	inline size_t inner_spawn_server_chunk_size = 0;
+
+	// NOTE: The spawn server is shared by every thread. Spawns go one at a time (inner_spawn_server_spawn_mutex),
+	// because a request and the next SPAWNED reply belong together. Replies are read by one waiting thread at a time
+	// and handed to the others through the condition variable. Everything below is guarded by inner_spawn_server_mutex.
+	inline std::mutex inner_spawn_server_spawn_mutex;
+	inline std::mutex inner_spawn_server_mutex;
+	inline std::condition_variable inner_spawn_server_condition;
+	inline bool inner_spawn_server_reading = false;
+	inline std::optional<inner_spawn_reply> inner_spawn_server_spawned_reply;
+	inline std::unordered_set<pid_t> inner_spawn_server_children;
+	inline std::unordered_map<pid_t, int> inner_spawn_server_exit_codes;
+
+	// NOTE: Commands that die because of a signal get the usual shell-style exit code of 128 + signal number.
+	inline int inner_exit_code_from_wstatus(int wstatus) noexcept {
+		if (WIFSIGNALED(wstatus)) { return 128 + WTERMSIG(wstatus); }
+		return WEXITSTATUS(wstatus);
+	}
+
+	[[noreturn]] inline void inner_spawn_server_main(int fd) noexcept {
+		sigset_t child_signal;
+		sigemptyset(&child_signal);
+		sigaddset(&child_signal, SIGCHLD);
+		sigprocmask(SIG_BLOCK, &child_signal, nullptr);
+		const int signal_fd = signalfd(-1, &child_signal, SFD_CLOEXEC | SFD_NONBLOCK);
+		if (signal_fd < 0) { _exit(EXIT_FAILURE); }
+
+		// NOTE: The children mustn't inherit the blocked SIGCHLD. The process group only applies to requests that ask for one.
+		posix_spawnattr_t spawn_attributes;
+		posix_spawnattr_init(&spawn_attributes);
+		sigset_t empty_signal_set;
+		sigemptyset(&empty_signal_set);
+		posix_spawnattr_setsigmask(&spawn_attributes, &empty_signal_set);
+		posix_spawnattr_setpgroup(&spawn_attributes, 0);
+
+		std::vector<char> request(SPAWN_SERVER_MAX_REQUEST_SIZE);
+		std::vector<char*> args;
+		std::vector<char*> environment;
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 3)];
+
+		// NOTE: A lost reply would leave the driver waiting forever, so there's no giving up on EINTR.
+		auto send_reply = [fd](const inner_spawn_reply &reply) {
+			while (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL) < 0) {
+				if (errno != EINTR) { _exit(EXIT_FAILURE); }
+			}
+		};
+
+		pollfd poll_fds[2] = { { fd, POLLIN, 0 }, { signal_fd, POLLIN, 0 } };
+		while (true) {
+			if (poll(poll_fds, 2, -1) < 0) {
+				if (errno == EINTR) { continue; }
+				_exit(EXIT_FAILURE);
+			}
+
+			if (poll_fds[1].revents != 0) {
+				signalfd_siginfo signal_info;
+				while (read(signal_fd, &signal_info, sizeof(signal_info)) > 0) { }
+
+				int wstatus;
+				pid_t pid;
+				while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+					send_reply({ inner_spawn_reply::EXITED, pid, inner_exit_code_from_wstatus(wstatus) });
+				}
+			}
+
+			if (poll_fds[0].revents == 0) { continue; }
+
+			iovec request_vector { request.data(), request.size() };
+			msghdr message { };
+			message.msg_iov = &request_vector;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			ssize_t request_size = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+			if (request_size == 0) { _exit(EXIT_SUCCESS); }		// NOTE: The driver is gone.
+			if (request_size < 0) {
+				if (errno == EINTR) { continue; }
+				_exit(EXIT_FAILURE);
+			}
+
+			int child_fds[3] = { -1, -1, -1 };
+			cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+			if (control_message != nullptr && control_message->cmsg_level == SOL_SOCKET && control_message->cmsg_type == SCM_RIGHTS
+			    && control_message->cmsg_len == CMSG_LEN(sizeof(child_fds))) {
+				std::memcpy(child_fds, CMSG_DATA(control_message), sizeof(child_fds));
+			}
+
+			// NOTE: Layout: u32 total size, u32 argc, u32 envc, u32 flags, then argc + envc + 1 NUL-terminated strings, the last one being the cwd.
+			// The only flag is SPAWN_NEW_PROCESS_GROUP.
+			// Only the first message of a request has the fds in it, the rest of the request follows in plain messages.
+			bool valid = !(message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) && child_fds[0] != -1 && (size_t)request_size >= 4 * sizeof(uint32_t);
+			uint32_t total_size = 0;
+			if (valid) {
+				std::memcpy(&total_size, request.data(), sizeof(uint32_t));
+				valid = total_size >= (size_t)request_size && total_size <= request.size();
+			}
+			while (valid && (size_t)request_size < total_size) {
+				ssize_t part_size = recv(fd, request.data() + request_size, total_size - request_size, 0);
+				if (part_size < 0 && errno == EINTR) { continue; }
+				if (part_size == 0) { _exit(EXIT_SUCCESS); }
+				if (part_size < 0) { _exit(EXIT_FAILURE); }
+				request_size += part_size;
+			}
+			valid &= (size_t)request_size == total_size;
+
+			uint32_t arg_count = 0, environment_count = 0, flags = 0;
+			const char *cwd = nullptr;
+			if (valid) {
+				std::memcpy(&arg_count, request.data() + sizeof(uint32_t), sizeof(uint32_t));
+				std::memcpy(&environment_count, request.data() + 2 * sizeof(uint32_t), sizeof(uint32_t));
+				std::memcpy(&flags, request.data() + 3 * sizeof(uint32_t), sizeof(uint32_t));
+
+				args.clear();
+				environment.clear();
+				char *head = request.data() + 4 * sizeof(uint32_t);
+				char *const end = request.data() + request_size;
+				for (uint32_t i = 0; i < arg_count + environment_count + 1; i++) {
+					char *string_end = (char*)std::memchr(head, '\0', end - head);
+					if (string_end == nullptr) { valid = false; break; }
+					if (i < arg_count) { args.push_back(head); }
+					else if (i < arg_count + environment_count) { environment.push_back(head); }
+					else { cwd = head; }
+					head = string_end + 1;
+				}
+				args.push_back(nullptr);
+				environment.push_back(nullptr);
+				valid &= arg_count != 0;
+			}
+
+			pid_t pid = -1;
+			int spawn_result = EINVAL;
+			if (valid) {
+				posix_spawn_file_actions_t file_actions;
+				posix_spawn_file_actions_init(&file_actions);
+				posix_spawn_file_actions_adddup2(&file_actions, child_fds[0], STDIN_FILENO);
+				posix_spawn_file_actions_adddup2(&file_actions, child_fds[1], STDOUT_FILENO);
+				posix_spawn_file_actions_adddup2(&file_actions, child_fds[2], STDERR_FILENO);
+				if (*cwd != '\0') { posix_spawn_file_actions_addchdir_np(&file_actions, cwd); }
+				posix_spawnattr_setflags(&spawn_attributes, POSIX_SPAWN_SETSIGMASK | (flags & SPAWN_NEW_PROCESS_GROUP ? POSIX_SPAWN_SETPGROUP : 0));
+
+				spawn_result = posix_spawnp(&pid, args[0], &file_actions, &spawn_attributes, args.data(), environment.data());
+				posix_spawn_file_actions_destroy(&file_actions);
+			}
+
+			for (int child_fd : child_fds) {
+				if (child_fd != -1) { close(child_fd); }
+			}
+
+			if (spawn_result != 0) { send_reply({ inner_spawn_reply::SPAWNED, -1, spawn_result }); }
+			else { send_reply({ inner_spawn_reply::SPAWNED, pid, 0 }); }
+		}
+	}
+
+	// NOTE: Blocks until is_done() returns true, it's only ever called with inner_spawn_server_mutex held.
+	// Whoever isn't reading replies right now becomes the reader, everybody else waits for the reader to hand them something.
+	// EXITED replies get stashed away for inner_wait_for_command, the SPAWNED reply for inner_spawn_through_server.
+	// Returns false if the server hung up.
+	template <typename functor_t>
+	bool inner_wait_for_spawn_reply(std::unique_lock<std::mutex> &lock, functor_t is_done) noexcept {
+		while (!is_done()) {
+			if (inner_spawn_server_reading) {
+				inner_spawn_server_condition.wait(lock);
+				continue;
+			}
+
+			inner_spawn_server_reading = true;
+			lock.unlock();
+			inner_spawn_reply reply;
+			ssize_t bytes_received;
+			do { bytes_received = recv(inner_spawn_server_fd, &reply, sizeof(reply), 0); } while (bytes_received < 0 && errno == EINTR);
+			lock.lock();
+			inner_spawn_server_reading = false;
+			inner_spawn_server_condition.notify_all();
+
+			if (bytes_received != sizeof(reply)) { return false; }
+			if (reply.type == inner_spawn_reply::EXITED) { inner_spawn_server_exit_codes[reply.pid] = reply.value; }
+			else { inner_spawn_server_spawned_reply = reply; }
+		}
+		return true;
+	}
+
+	// NOTE: Returns false if the request couldn't even be sent (too big, for example), the caller spawns directly in that case.
+	inline bool inner_spawn_through_server(char * const *args, int output_fd, const char *working_directory, bool new_process_group, pid_t &pid, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		std::string request(4 * sizeof(uint32_t), '\0');
+		uint32_t arg_count = 0, environment_count = 0;
+		for (; args[arg_count] != nullptr; arg_count++) { request.append(args[arg_count], std::strlen(args[arg_count]) + 1); }
+		for (; environ[environment_count] != nullptr; environment_count++) {
+			request.append(environ[environment_count], std::strlen(environ[environment_count]) + 1);
+		}
+		std::memcpy(request.data() + sizeof(uint32_t), &arg_count, sizeof(uint32_t));
+		std::memcpy(request.data() + 2 * sizeof(uint32_t), &environment_count, sizeof(uint32_t));
+		const uint32_t flags = new_process_group ? SPAWN_NEW_PROCESS_GROUP : 0;
+		std::memcpy(request.data() + 3 * sizeof(uint32_t), &flags, sizeof(uint32_t));
+
+		// NOTE: The server's cwd is wherever the driver was when the server was started, so the cwd is always sent along.
+		if (working_directory != nullptr) { request.append(working_directory, std::strlen(working_directory) + 1); }
+		else {
+			char cwd[PATH_MAX + 1];
+			inner_count(counter_t::GETCWD);
+			if (getcwd(cwd, sizeof(cwd)) == nullptr) { return false; }
+			request.append(cwd, std::strlen(cwd) + 1);
+		}
+
+		if (request.size() > SPAWN_SERVER_MAX_REQUEST_SIZE) { return false; }
+		const uint32_t total_size = request.size();
+		std::memcpy(request.data(), &total_size, sizeof(uint32_t));
+
+		const int child_fds[3] = { STDIN_FILENO, output_fd == -1 ? STDOUT_FILENO : output_fd, output_fd == -1 ? STDERR_FILENO : output_fd };
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(child_fds))] { };
+
+		std::lock_guard<std::mutex> spawn_lock(inner_spawn_server_spawn_mutex);
+
+		// NOTE: The fds go along with the first message. If that one can't be sent, nothing was, and spawning directly is still an option.
+		// Once it's out, the rest of the request has to follow, there's no taking it back anymore.
+		bool hung_up = false;
+		for (size_t position = 0; position < request.size() && !hung_up; ) {
+			iovec request_vector { request.data() + position, std::min(request.size() - position, inner_spawn_server_chunk_size) };
+			msghdr message { };
+			message.msg_iov = &request_vector;
+			message.msg_iovlen = 1;
+			if (position == 0) {
+				message.msg_control = control;
+				message.msg_controllen = sizeof(control);
+				cmsghdr *control_message = CMSG_FIRSTHDR(&message);
+				control_message->cmsg_level = SOL_SOCKET;
+				control_message->cmsg_type = SCM_RIGHTS;
+				control_message->cmsg_len = CMSG_LEN(sizeof(child_fds));
+				std::memcpy(CMSG_DATA(control_message), child_fds, sizeof(child_fds));
+			}
+
+			if (sendmsg(inner_spawn_server_fd, &message, MSG_NOSIGNAL) < 0) {
+				if (errno == EINTR) { continue; }
+				if (position == 0) { return false; }
+				hung_up = true;
+			}
+			position += request_vector.iov_len;
+		}
+
+		std::unique_lock<std::mutex> lock(inner_spawn_server_mutex);
+		if (hung_up || !inner_wait_for_spawn_reply(lock, []() { return inner_spawn_server_spawned_reply.has_value(); })) {
+			lime::bug("lime spawn server hung up unexpectedly");
+			lime::exit_program(EXIT_FAILURE);
+		}
+		const inner_spawn_reply reply = *inner_spawn_server_spawned_reply;
+		inner_spawn_server_spawned_reply.reset();
+
+		if (reply.pid == -1) {
+			errno = reply.value;
+			error = error_t::CMD_INVOKE_FAILED;
+			return true;
+		}
+
+		pid = reply.pid;
+		inner_spawn_server_children.insert(pid);
+		return true;
+	}
+
+	// NOTE: Call this as early as possible in main, the whole point is for the server to be forked off
+	// while the driver is still small.
+	inline void start_spawn_server(error_t &error) noexcept {
 		error = error_t::SUCCESS;
 
-		std::vector<lime::string> quote_separated = cmdline.split('\"');
+		if (inner_spawn_server_fd != -1) { return; }
+
+		int socket_fds[2];
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socket_fds) < 0) { error = error_t::SOCKET_FAILED; return; }
+
+		// NOTE: Otherwise whatever is buffered right now would be written twice.
+		fflush(stdout);
+
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(socket_fds[0]);
+			inner_spawn_server_main(socket_fds[1]);
+		}
+
+		close(socket_fds[1]);
+		if (pid < 0) {
+			close(socket_fds[0]);
+			error = error_t::ERRNO;
+			return;
+		}
+
+		// NOTE: The bigger the send buffer, the fewer messages per request. SO_SNDBUFFORCE gets past net.core.wmem_max,
+		// but only with CAP_NET_ADMIN, otherwise the kernel quietly caps the size, so what we actually got is read back.
+		const int send_buffer_size = SPAWN_SERVER_MAX_REQUEST_SIZE;
+		if (setsockopt(socket_fds[0], SOL_SOCKET, SO_SNDBUFFORCE, &send_buffer_size, sizeof(send_buffer_size)) < 0) {
+			setsockopt(socket_fds[0], SOL_SOCKET, SO_SNDBUF, &send_buffer_size, sizeof(send_buffer_size));
+		}
+		int actual_send_buffer_size = 0;
+		socklen_t option_size = sizeof(actual_send_buffer_size);
+		if (getsockopt(socket_fds[0], SOL_SOCKET, SO_SNDBUF, &actual_send_buffer_size, &option_size) < 0) { actual_send_buffer_size = 0; }
+		inner_spawn_server_chunk_size = std::max<size_t>(actual_send_buffer_size / 2, 4096);
+
+		inner_spawn_server_fd = socket_fds[0];
+	}
+
+	// NOTE: Not having a spawn server isn't fatal, commands are just spawned directly then.
+	inline void start_spawn_server() noexcept {
+		error_t error;
+		start_spawn_server(error);
+		if (error != error_t::SUCCESS) { lime::warn("couldn't start spawn server, spawning commands directly"); }
+	}
+
+	// NOTE: Starts the command without waiting for it. If output_fd isn't -1, the child's stdout and stderr
+	// get redirected to it. If working_directory isn't nullptr, the child runs in there.
+	// If new_process_group is set, the child leads a process group of its own (with its pid as the group ID),
+	// so that it can be killed together with everything it started.
+	// posix_spawn is used instead of hand-rolled vfork + execvp because it lets us set up the fds and the cwd
+	// for the child without touching the parent's memory, and glibc still does the vfork-style clone underneath.
+	inline pid_t inner_spawn_command(const lime::string &cmdline, int output_fd, const char *working_directory, error_t &error, bool new_process_group = false) noexcept {
+		error = error_t::SUCCESS;
 
-		std::vector<lime::string> final_args;
-		for (size_t i = 0; i < quote_separated.size(); i += 2) {
-			std::vector<lime::string> new_args = quote_separated[0].split(' ');
-			for (const lime::string &arg : new_args) { final_args.push_back(arg); }
-			final_args.push_back(quote_separated[i + 1]);
+		std::vector<std::string_view> args;
+		std::string unquote_buffer;
+		inner_tokenize_command_line(std::string_view(cmdline.c_str(), cmdline.length()), args, unquote_buffer);
+		if (args.empty()) { error = error_t::CMD_INVOKE_FAILED; return -1; }
+
+		// NOTE: argv wants NUL-terminated strings, so all the arguments get copied into one buffer, one allocation for the whole thing.
+		// The arguments are never longer than the command line, so the buffer doesn't reallocate and the pointers into it stay valid.
+		std::string argument_buffer;
+		argument_buffer.reserve(cmdline.length() + args.size());
+		std::vector<char*> converted_args;
+		converted_args.reserve(args.size() + 1);
+		for (std::string_view arg : args) {
+			converted_args.push_back(argument_buffer.data() + argument_buffer.size());
+			argument_buffer.append(arg);
+			argument_buffer += '\0';
 		}
+		converted_args.push_back(nullptr);
 
-		const char * const target_file = final_args[0].c_str();
+		inner_count(counter_t::SPAWNS);
+
+		if (inner_spawn_server_fd != -1) {
+			pid_t pid;
+			if (inner_spawn_through_server(converted_args.data(), output_fd, working_directory, new_process_group, pid, error)) {
+				return error == error_t::SUCCESS ? pid : -1;
+			}
+		}
 
-		// TODO: Why does execvp reserve the right to change this? Can it actually or is it's
-		// function signature just badly made.
-		char * * const converted_final_args = new (std::nothrow) char*[final_args.size() + 1];
-		for (size_t i = 0; i < final_args.size(); i++) {
-			converted_final_args[i] = final_args[i].data();
+		posix_spawn_file_actions_t file_actions;
+		if (posix_spawn_file_actions_init(&file_actions) != 0) { error = error_t::CMD_INVOKE_FAILED; return -1; }
+		if (output_fd != -1) {
+			posix_spawn_file_actions_adddup2(&file_actions, output_fd, STDOUT_FILENO);
+			posix_spawn_file_actions_adddup2(&file_actions, output_fd, STDERR_FILENO);
+		}
+		if (working_directory != nullptr) { posix_spawn_file_actions_addchdir_np(&file_actions, working_directory); }
+
+		// NOTE: An event_loop blocks SIGCHLD while it needs it for its signalfd, the children mustn't inherit that.
+		posix_spawnattr_t spawn_attributes;
+		posix_spawnattr_init(&spawn_attributes);
+		sigset_t signal_mask;
+		pthread_sigmask(SIG_BLOCK, nullptr, &signal_mask);
+		sigdelset(&signal_mask, SIGCHLD);
+		posix_spawnattr_setsigmask(&spawn_attributes, &signal_mask);
+		posix_spawnattr_setpgroup(&spawn_attributes, 0);
+		posix_spawnattr_setflags(&spawn_attributes, POSIX_SPAWN_SETSIGMASK | (new_process_group ? POSIX_SPAWN_SETPGROUP : 0));
+
+		pid_t pid;
+		int spawn_result = posix_spawnp(&pid, converted_args[0], &file_actions, &spawn_attributes, converted_args.data(), environ);
+		posix_spawn_file_actions_destroy(&file_actions);
+		posix_spawnattr_destroy(&spawn_attributes);
+
+		if (spawn_result != 0) {
+			errno = spawn_result;
+			error = error_t::CMD_INVOKE_FAILED;
+			return -1;
 		}
-		*(converted_final_args.end() - 1) = nullptr;
 
-		pid_t vfork_result = vfork();
+		return pid;
+	}
 
-		// CHILD
-		if (vfork_result == 0) {
-			if (execvp(target_file, converted_final_args) < 0) {
-				// TODO: How the hell am I going to get the errno from here back to
-				// the main program? I need it there to process it and potentially
-				// throw something on the command line or do something else.
-				// NOTE: I have to use _exit here because of the requirements for vfork().
-				std::_exit(EXIT_FAILURE);
+	inline int inner_wait_for_command(pid_t pid, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+		inner_wait_timer wait_timer;
+
+		// NOTE: Children of the spawn server aren't ours to wait for, the server tells us when they exit.
+		if (inner_spawn_server_fd != -1) {
+			std::unique_lock<std::mutex> lock(inner_spawn_server_mutex);
+			if (inner_spawn_server_children.erase(pid) != 0) {
+				if (!inner_wait_for_spawn_reply(lock, [pid]() { return inner_spawn_server_exit_codes.count(pid) != 0; })) {
+					lime::bug("lime spawn server hung up unexpectedly");
+					lime::exit_program(EXIT_FAILURE);
+				}
+				const int result = inner_spawn_server_exit_codes[pid];
+				inner_spawn_server_exit_codes.erase(pid);
+				return result;
 			}
 		}
-		
-		// PARENT
-		delete[] converted_final_args;
 
-		if (vfork_result == -1) { error = error_t::CMD_INVOKE_FAILED; return; }
+		int wstatus;
+		while (waitpid(pid, &wstatus, 0) == -1) {
+			if (errno == EINTR) { continue; }
+			error = error_t::CMD_INVOKE_FAILED;
+			return -1;
+		}
+
+		return inner_exit_code_from_wstatus(wstatus);
+	}
+
+	// NOTE: inner_wait_for_command without the waiting. Returns false if the command is still running.
+	inline bool inner_try_wait_for_command(pid_t pid, int &exit_code, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		if (inner_spawn_server_fd != -1) {
+			std::lock_guard<std::mutex> lock(inner_spawn_server_mutex);
+			if (inner_spawn_server_children.count(pid) != 0) {
+				// NOTE: If some other thread is reading replies right now, it'll stash ours too.
+				if (!inner_spawn_server_reading) {
+					inner_spawn_reply reply;
+					while (recv(inner_spawn_server_fd, &reply, sizeof(reply), MSG_DONTWAIT) == sizeof(reply)) {
+						if (reply.type == inner_spawn_reply::EXITED) { inner_spawn_server_exit_codes[reply.pid] = reply.value; }
+						else { inner_spawn_server_spawned_reply = reply; }
+					}
+					inner_spawn_server_condition.notify_all();
+				}
+
+				auto stashed_exit_code = inner_spawn_server_exit_codes.find(pid);
+				if (stashed_exit_code == inner_spawn_server_exit_codes.end()) { return false; }
+				exit_code = stashed_exit_code->second;
+				inner_spawn_server_exit_codes.erase(stashed_exit_code);
+				inner_spawn_server_children.erase(pid);
+				return true;
+			}
+		}
 
 		int wstatus;
-		if (wait(&wstatus) == -1) { error = error_t::CMD_INVOKE_FAILED; return; }
-		if (WIFEXITED(wstatus)) {
-			// TODO: You definitely want to expose the exit code to the user,
-			// figure out an elegant way to do that.
-			if (WEXITSTATUS(wstatus) != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; return; }
+		pid_t result;
+		while ((result = waitpid(pid, &wstatus, WNOHANG)) == -1) {
+			if (errno == EINTR) { continue; }
+			error = error_t::CMD_INVOKE_FAILED;
+			return true;
+		}
+		if (result == 0) { return false; }
+
+		exit_code = inner_exit_code_from_wstatus(wstatus);
+		return true;
+	}
+
+	// NOTE: If working_directory isn't nullptr, the command runs in there.
+	inline void inner_execute_command(const lime::string &cmdline, const char *working_directory, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		pid_t pid = inner_spawn_command(cmdline, -1, working_directory, error);
+		if (error != error_t::SUCCESS) { return; }
+
+		// TODO: You definitely want to expose the exit code to the user,
+		// figure out an elegant way to do that.
+		int exit_code = inner_wait_for_command(pid, error);
+		if (error != error_t::SUCCESS) { return; }
+		if (exit_code != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; return; }
+	}
+
+	inline void inner_execute_command(const lime::string &cmdline, error_t &error) noexcept { inner_execute_command(cmdline, nullptr, error); }
+
+	// NOTE: Runs the command to completion and collects everything it writes to stdout and stderr.
+	inline int inner_capture_command(const lime::string &cmdline, std::string &output, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+		output.clear();
+
+		int output_pipe[2];
+		if (pipe2(output_pipe, O_CLOEXEC) < 0) { error = error_t::CMD_INVOKE_FAILED; return -1; }
+
+		pid_t pid = inner_spawn_command(cmdline, output_pipe[1], nullptr, error);
+		close(output_pipe[1]);
+		if (error != error_t::SUCCESS) { close(output_pipe[0]); return -1; }
+
+		{
+			inner_wait_timer wait_timer;
+			char buffer[4096];
+			while (true) {
+				ssize_t bytes_read = read(output_pipe[0], buffer, sizeof(buffer));
+				if (bytes_read == 0) { break; }
+				if (bytes_read < 0) {
+					if (errno == EINTR) { continue; }
+					break;
+				}
+				output.append(buffer, bytes_read);
+			}
 		}
-		if (WIFSIGNALED(wstatus)) { error = error_t::CMD_RETURNED_FAILURE; return; }
-		return;
+		close(output_pipe[0]);
+
+		return inner_wait_for_command(pid, error);
 	}
 
 	inline void exec(const lime::string& cmdline) noexcept {
 		lime::cmd_label(cmdline);
-		switch (inner_execute_command(cmdline)) {
-		case inner_execute_command_return_t::SUCCESS: break;
-		case inner_execute_command_return_t::COMMAND_FAILED: lime::error("exec(cmdline) failed, invoked command failed"); exit_program(1);
-		case inner_execute_command_return_t::INVOKE_FAILED: lime::error("exec(cmdline) failed because of unsuccessful invocation"); exit_program(1);
+
+		error_t error;
+		inner_execute_command(cmdline, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+		case error_t::CMD_RETURNED_FAILURE: lime::error("exec(cmdline) failed, invoked command failed"); exit_program(1);
+		case error_t::CMD_INVOKE_FAILED: lime::error("exec(cmdline) failed because of unsuccessful invocation"); exit_program(1);
+		default: lime::bug("exec(cmdline) failed, unknown error"); exit_program(1);
 		}
 	}
 
@@ -856,6 +1647,7 @@ namespace lime {
 
 		glob_t glob_result;
 		// TODO: Fix that thing where if glob spec if an absolute path then it'll look in root instead. Make sure glob path isn't absolute.
+		inner_count(counter_t::GLOB);
 		if (glob(query.c_str(), 0, nullptr, &glob_result) != 0) {
 			lime::error("lime::enum_files failed, glob failed, general failure");
 			lime::exit_program(1);
@@ -878,41 +1670,4613 @@ namespace lime {
 		return result;
 	}
 
-	inline std::vector<lime::string> enum_files_recursive(const lime::string& target_dir, const lime::string& query) noexcept {
-		std::vector<lime::string> children = enum_files(target_dir, query);
-		for (decltype(children)::iterator it = children.begin(); it < children.end(); it++) {
-			if ((*it).is_existing_directory()) {
-				std::vector<lime::string> grandchildren = enum_files_recursive(*it, query);
-				children.erase(it);
-				children.insert(children.end(), grandchildren.begin(), grandchildren.end());
-				it--;
+	// NOTE: Lazy recursive directory walk. Entries come out one at a time as the directories get read,
+	// nothing gets collected up front, so callers can start working on the first file while the rest of the tree
+	// hasn't even been looked at yet. Memory stays at one open directory and one path buffer per level of depth,
+	// no matter how many files there are.
+	// Only non-directory entries whose names match the glob query get yielded. Every directory gets descended into,
+	// except hidden ones, unless the query starts with a dot (same as with glob). Symlinks to directories aren't followed,
+	// they're yielded as DT_LNK entries like any other symlink, so link cycles can't send the walk around in circles.
+	// The entries are views into the walker and are only valid until the iterator gets advanced.
+	class directory_walker {
+	public:
+		struct entry {
+			std::string_view name;
+			std::string_view relative_path;		// NOTE: Relative to the root of the walk.
+			int directory_fd;			// NOTE: The directory the entry is in, name is relative to it, for openat and friends.
+			unsigned char type;			// NOTE: DT_REG, DT_LNK and so on, like in dirent.
+			const directory_walker *walker;
+
+			lime::string get_path() const noexcept { return walker->root == "/" ? '/' + std::string(relative_path) : walker->root + '/' + std::string(relative_path); }
+		};
+
+		class iterator {
+			directory_walker *walker;
+
+		public:
+			using value_type = entry;
+			using difference_type = std::ptrdiff_t;
+			using iterator_category = std::input_iterator_tag;
+
+			iterator(directory_walker *walker) noexcept : walker(walker) { }
+
+			const entry& operator*() const noexcept { return walker->current; }
+			const entry* operator->() const noexcept { return &walker->current; }
+
+			iterator& operator++() noexcept {
+				if (!walker->advance()) { walker = nullptr; }
+				return *this;
+			}
+			void operator++(int) noexcept { ++*this; }
+
+			bool operator==(std::default_sentinel_t) const noexcept { return walker == nullptr; }
+		};
+
+	private:
+		struct level_t {
+			DIR *directory;
+			size_t path_length;
+		};
+
+		std::string root;
+		std::string query;
+		std::string relative_path;
+		std::vector<level_t> levels;
+		entry current { };
+		bool exit_on_error;
+		error_t walk_error = error_t::SUCCESS;
+
+		bool fail() noexcept {
+			if (exit_on_error) {
+				lime::error("lime::directory_walker failed to read \"" + root + '/' + relative_path + '\"');
+				lime::exit_program(EXIT_FAILURE);
 			}
+			walk_error = error_t::ERRNO;
+			for (const level_t &level : levels) { closedir(level.directory); }
+			levels.clear();
+			return false;
 		}
-		return children;
-	}
 
-	inline void create_path(const lime::string& path) noexcept {
-		lime::string real_path = path.to_canonicalized_absolute();
-		lime::string current_path;
-		for (size_t i = 0; i < real_path.num_path_parts(); i++) {
-			current_path /= real_path.path_part(i);
-			if (!current_path.is_existing_directory()) {
-				// TODO: Just inherit from parent folder, I think that's the best option, right?
-				if (open(current_path.c_str(), O_CREAT, S_IRWXU | S_IRGRP | S_IROTH) < 0) {
-					lime::error("failed to create the target file in lime::create_path for some reason");
+		bool advance() noexcept {
+			while (!levels.empty()) {
+				DIR *const directory = levels.back().directory;
+				const size_t path_length = levels.back().path_length;
+
+				errno = 0;
+				dirent *directory_entry = readdir(directory);
+				if (directory_entry == nullptr) {
+					if (errno != 0) { relative_path.resize(path_length); return fail(); }
+					closedir(directory);
+					levels.pop_back();
+					continue;
 				}
-				return;
-			}
-			// TODO: Just inherit from parent folder, same as above.
-			if (mkdir(current_path.c_str(), S_IRWXU | S_IRGRP | S_IROTH) < 0) {
-				switch (errno) {
-				case EEXIST: continue;
-				default:
-					lime::error("mkdir failed in lime::create_path, general failure");
-					lime::exit_program(1);
+
+				const char *name = directory_entry->d_name;
+				if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) { continue; }
+
+				unsigned char type = directory_entry->d_type;
+				if (type == DT_UNKNOWN) {
+					// NOTE: Some filesystems don't fill d_type in.
+					struct stat stat_buf;
+					inner_count(counter_t::STAT);
+					if (inner_fstatat(dirfd(directory), name, &stat_buf, AT_SYMLINK_NOFOLLOW) == 0) {
+						type = S_ISDIR(stat_buf.st_mode) ? DT_DIR : S_ISLNK(stat_buf.st_mode) ? DT_LNK : S_ISREG(stat_buf.st_mode) ? DT_REG : DT_UNKNOWN;
+					}
+				}
+
+				relative_path.resize(path_length);
+				if (path_length != 0) { relative_path += '/'; }
+				relative_path += name;
+
+				if (type == DT_DIR) {
+					if (name[0] == '.' && query[0] != '.') { continue; }
+
+					const int subdirectory_fd = openat(dirfd(directory), name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+					DIR *subdirectory = subdirectory_fd < 0 ? nullptr : fdopendir(subdirectory_fd);
+					if (subdirectory == nullptr) {
+						if (subdirectory_fd >= 0) { close(subdirectory_fd); }
+						return fail();
+					}
+					levels.push_back({ subdirectory, relative_path.size() });
+					continue;
 				}
+
+				if (fnmatch(query.c_str(), name, FNM_PERIOD) != 0) { continue; }
+
+				const size_t name_length = relative_path.size() - (path_length == 0 ? 0 : path_length + 1);
+				current.relative_path = relative_path;
+				current.name = current.relative_path.substr(relative_path.size() - name_length);
+				current.directory_fd = dirfd(directory);
+				current.type = type;
+				return true;
 			}
+			return false;
 		}
+
+		void open_root(const lime::string &target_dir) noexcept {
+			root = target_dir.to_absolute().to_std_string();
+			while (root.size() > 1 && root.back() == '/') { root.pop_back(); }
+			current.walker = this;
+
+			DIR *directory = opendir(root.c_str());
+			if (directory == nullptr) { fail(); return; }
+			levels.push_back({ directory, 0 });
+		}
+
+	public:
+		directory_walker(const lime::string &target_dir, const lime::string &query) noexcept : query(query.to_std_string()), exit_on_error(true) {
+			open_root(target_dir);
+		}
+
+		// NOTE: Doesn't exit on failure. If the root can't be opened, error is set and the walk is empty.
+		// Failures further down end the walk early, check get_error() once the loop is done.
+		directory_walker(const lime::string &target_dir, const lime::string &query, error_t &error) noexcept : query(query.to_std_string()), exit_on_error(false) {
+			open_root(target_dir);
+			error = walk_error;
+		}
+
+		directory_walker(const directory_walker&) = delete;
+		directory_walker& operator=(const directory_walker&) = delete;
+
+		~directory_walker() noexcept {
+			for (const level_t &level : levels) { closedir(level.directory); }
+		}
+
+		// NOTE: It's an input range, it can only be walked once.
+		iterator begin() noexcept { return iterator(advance() ? this : nullptr); }
+		std::default_sentinel_t end() const noexcept { return { }; }
+
+		error_t get_error() const noexcept { return walk_error; }
+	};
+
+	// NOTE: Collects the whole walk, see lime::directory_walker for the lazy version, which is what you want for big trees.
+	inline std::vector<lime::string> enum_files_recursive(const lime::string& target_dir, const lime::string& query) noexcept {
+		std::vector<lime::string> result;
+		for (const directory_walker::entry &entry : directory_walker(target_dir, query)) { result.push_back(entry.get_path()); }
+		return result;
+	}
+
+	inline void create_path(const lime::string& path) noexcept {
+		lime::string real_path = path.to_canonicalized_absolute();
+		lime::string current_path;
+		for (size_t i = 0; i < real_path.num_path_parts(); i++) {
+			current_path /= real_path.path_part(i);
+			if (!current_path.is_existing_directory()) {
+				// TODO: Just inherit from parent folder, I think that's the best option, right?
+				if (open(current_path.c_str(), O_CREAT, S_IRWXU | S_IRGRP | S_IROTH) < 0) {
+					lime::error("failed to create the target file in lime::create_path for some reason");
+				}
+				return;
+			}
+			// TODO: Just inherit from parent folder, same as above.
+			inner_count(counter_t::MKDIR);
+			if (mkdir(current_path.c_str(), S_IRWXU | S_IRGRP | S_IROTH) < 0) {
+				switch (errno) {
+				case EEXIST: continue;
+				default:
+					lime::error("mkdir failed in lime::create_path, general failure");
+					lime::exit_program(1);
+				}
+			}
+		}
+	}
+
+	// NOTE: Small file helpers. They return false on failure and leave errno alone, so the caller
+	// can decide whether the failure is an error or a bug.
+	inline bool inner_write_all(int fd, const char *data, size_t size) noexcept {
+		while (size != 0) {
+			ssize_t bytes_written = write(fd, data, size);
+			if (bytes_written < 0) {
+				if (errno == EINTR) { continue; }
+				return false;
+			}
+			data += bytes_written;
+			size -= bytes_written;
+		}
+		return true;
+	}
+
+	inline bool inner_read_file(const char *path, std::string &result) noexcept {
+		result.clear();
+
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) { return false; }
+
+		char buffer[65536];
+		while (true) {
+			ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+			if (bytes_read == 0) { break; }
+			if (bytes_read < 0) {
+				if (errno == EINTR) { continue; }
+				close(fd);
+				return false;
+			}
+			result.append(buffer, bytes_read);
+		}
+
+		close(fd);
+		return true;
+	}
+
+	inline bool inner_write_file(const char *path, const std::string &data) noexcept {
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (fd < 0) { return false; }
+		bool success = inner_write_all(fd, data.data(), data.size());
+		if (close(fd) < 0) { return false; }
+		return success;
+	}
+
+	// NOTE: Same as mkdir -p. Existing directories aren't an error.
+	inline bool inner_make_directories(const std::string &path) noexcept {
+		for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+			const std::string prefix = path.substr(0, slash);
+			if (!prefix.empty()) {
+				inner_count(counter_t::MKDIR);
+				if (mkdir(prefix.c_str(), 0777) < 0 && errno != EEXIST) { return false; }
+			}
+			if (slash == std::string::npos) { return true; }
+		}
+	}
+
+	inline bool inner_make_parent_directories(const std::string &path) noexcept {
+		size_t last_slash = path.rfind('/');
+		if (last_slash == std::string::npos || last_slash == 0) { return true; }
+		return inner_make_directories(path.substr(0, last_slash));
+	}
+
+	// NOTE: Written to a temporary file first and then renamed over the target, so concurrent builds (and builds that get killed)
+	// never leave half a file behind. Makes the parent directories if they don't exist yet.
+	inline bool inner_atomic_write_file(const std::string &path, const std::string &data) noexcept {
+		const std::string temporary_path = path + ".tmp." + std::to_string(getpid());
+		if (!inner_make_parent_directories(path) || !inner_write_file(temporary_path.c_str(), data) || rename(temporary_path.c_str(), path.c_str()) < 0) {
+			unlink(temporary_path.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// NOTE: Calls handle_line(const std::string&) for every line of the content, without the newline.
+	// A last line without a newline is left out, the file it came from wasn't written by us.
+	template <typename functor_t>
+	void inner_for_each_line(const std::string &content, functor_t handle_line) noexcept {
+		std::string line;
+		for (size_t line_start = 0; line_start < content.size(); ) {
+			const size_t line_end = content.find('\n', line_start);
+			if (line_end == std::string::npos) { return; }
+			line.assign(content, line_start, line_end - line_start);
+			line_start = line_end + 1;
+			handle_line((const std::string&)line);
+		}
+	}
+
+	// NOTE: Same as rm -rf. Symlinks are removed, not followed.
+	inline bool inner_remove_tree(const char *path) noexcept {
+		return nftw(path, [](const char *entry_path, const struct stat*, int, struct FTW*) {
+			return remove(entry_path);
+		}, 64, FTW_DEPTH | FTW_PHYS) == 0;
+	}
+
+	inline bool inner_set_nonblocking(int fd) noexcept {
+		int flags = fcntl(fd, F_GETFL);
+		if (flags < 0) { return false; }
+		return fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+	}
+
+	// NOTE: Reads everything that's currently available from a nonblocking fd.
+	// Returns false once the other side hung up (or the fd broke), whatever was read before that is still in the buffer.
+	inline bool inner_receive_available(int fd, std::string &buffer) noexcept {
+		char chunk[65536];
+		while (true) {
+			ssize_t bytes_read = read(fd, chunk, sizeof(chunk));
+			if (bytes_read > 0) { buffer.append(chunk, bytes_read); continue; }
+			if (bytes_read == 0) { return false; }
+			if (errno == EINTR) { continue; }
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+	}
+
+	// NOTE: Sends as much of the buffer as the socket takes right now and removes the sent part.
+	inline bool inner_send_available(int fd, std::string &buffer) noexcept {
+		size_t position = 0;
+		while (position < buffer.size()) {
+			ssize_t bytes_sent = send(fd, buffer.data() + position, buffer.size() - position, MSG_NOSIGNAL);
+			if (bytes_sent < 0) {
+				if (errno == EINTR) { continue; }
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+				return false;
+			}
+			position += bytes_sent;
+		}
+		buffer.erase(0, position);
+		return true;
+	}
+
+	// NOTE: Everything below is for offloading exec jobs to worker daemons.
+	// The protocol is dead-simple: every frame is a u32 length, followed by a one byte frame type and the payload.
+	// The length counts the type byte and the payload. Everything is in host byte order, because the workers
+	// live on the same box for now (Unix domain sockets).
+	// The client never waits for a reply before sending the next job (pipelining), and all the frames
+	// that one scheduling pass produces go out in one write (batching), so small jobs aren't dominated by round-trips.
+	enum class remote_frame_t : uint8_t {
+		HELLO,		// worker -> client: u32 capacity
+		JOB,		// client -> worker: u64 id, u32 flags, cwd, cmdline, u32 input count, (path, content)..., u32 output count, path...
+		LOG,		// worker -> client: u64 id, bytes
+		OUTPUT,		// worker -> client: u64 id, path, content
+		EXIT,		// worker -> client: u64 id, i32 exit code
+	};
+
+	// NOTE: With a shared filesystem, the worker runs the job right in the client's cwd, and no files are sent either way.
+	// Without it, the worker runs the job in a private staging directory, into which the inputs are written.
+	// The outputs are read back from there and sent to the client.
+	constexpr uint32_t REMOTE_JOB_SHARED_FILESYSTEM = 1;
+
+	// NOTE: Appends one frame to the buffer, the length gets filled in when the writer goes out of scope.
+	class inner_frame_writer {
+		std::string &buffer;
+		size_t frame_start;
+
+	public:
+		inner_frame_writer(std::string &buffer, remote_frame_t type) noexcept : buffer(buffer), frame_start(buffer.size()) {
+			buffer.append(sizeof(uint32_t), '\0');
+			buffer += (char)type;
+		}
+
+		~inner_frame_writer() noexcept {
+			uint32_t length = buffer.size() - frame_start - sizeof(uint32_t);
+			std::memcpy(buffer.data() + frame_start, &length, sizeof(length));
+		}
+
+		template <typename T>
+		void put(T value) noexcept { buffer.append((const char*)&value, sizeof(value)); }
+
+		void put_bytes(const char *data, size_t size) noexcept {
+			put((uint32_t)size);
+			buffer.append(data, size);
+		}
+		void put_bytes(const std::string &data) noexcept { put_bytes(data.data(), data.size()); }
+	};
+
+	class inner_frame_reader {
+		const char *head;
+		const char *end;
+		bool valid = true;
+
+	public:
+		inner_frame_reader(const char *data, size_t size) noexcept : head(data), end(data + size) { }
+
+		template <typename T>
+		T get() noexcept {
+			T value { };
+			if ((size_t)(end - head) < sizeof(T)) { valid = false; return value; }
+			std::memcpy(&value, head, sizeof(T));
+			head += sizeof(T);
+			return value;
+		}
+
+		std::string get_bytes() noexcept {
+			uint32_t size = get<uint32_t>();
+			if (!valid || (size_t)(end - head) < size) { valid = false; return std::string(); }
+			std::string result(head, size);
+			head += size;
+			return result;
+		}
+
+		bool is_valid() const noexcept { return valid; }
+	};
+
+	// NOTE: Calls handler(type, reader) for every complete frame in the buffer and removes them from it.
+	// The handler returns false if it didn't like the frame, in which case the connection should be dropped.
+	template <typename handler_t>
+	bool inner_consume_frames(std::string &buffer, handler_t handler) noexcept {
+		size_t position = 0;
+		while (buffer.size() - position >= sizeof(uint32_t)) {
+			uint32_t length;
+			std::memcpy(&length, buffer.data() + position, sizeof(length));
+			if (length == 0) { return false; }
+			if (buffer.size() - position - sizeof(uint32_t) < length) { break; }
+
+			const char *frame = buffer.data() + position + sizeof(uint32_t);
+			inner_frame_reader reader(frame + 1, length - 1);
+			if (!handler((remote_frame_t)frame[0], reader) || !reader.is_valid()) { return false; }
+
+			position += sizeof(uint32_t) + length;
+		}
+		buffer.erase(0, position);
+		return true;
+	}
+
+	// NOTE: Paths sent to workers without a shared filesystem have to stay inside of the staging directory.
+	inline bool inner_is_contained_relative_path(const std::string &path) noexcept {
+		if (path.empty() || path[0] == '/') { return false; }
+		for (size_t start = 0; start <= path.size(); ) {
+			size_t slash = path.find('/', start);
+			if (slash == std::string::npos) { slash = path.size(); }
+			if (path.compare(start, slash - start, "..") == 0) { return false; }
+			start = slash + 1;
+		}
+		return true;
+	}
+
+	inline int inner_connect_unix_socket(const lime::string &socket_path, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		sockaddr_un address { };
+		address.sun_family = AF_UNIX;
+		if (socket_path.length() >= sizeof(address.sun_path)) { error = error_t::SOCKET_FAILED; return -1; }
+		std::memcpy(address.sun_path, socket_path.c_str(), socket_path.length() + 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) { error = error_t::SOCKET_FAILED; return -1; }
+		if (connect(fd, (const sockaddr*)&address, sizeof(address)) < 0) {
+			close(fd);
+			error = error_t::SOCKET_FAILED;
+			return -1;
+		}
+
+		return fd;
+	}
+
+	// NOTE: -1 if pidfds aren't available (kernels before 5.3).
+	inline int inner_open_pidfd(pid_t pid) noexcept { return syscall(SYS_pidfd_open, pid, 0); }
+
+	// NOTE: One step of watching a child that writes into log_fd, call it whenever poll says something happened on log_fd or pid_fd.
+	// The child is done once it exited, not once the pipe closed: a child can close its output and keep running,
+	// and a grandchild can hold the pipe open long after the child is gone. The exit is noticed through the pidfd,
+	// so reaping it never blocks. Without a pidfd, the pipe closing is all there is to go on, then the wait can block.
+	// Returns true once the child is reaped, both fds are closed and exit_code is set then (127 if waiting failed).
+	inline bool inner_poll_child(pid_t pid, int &log_fd, int &pid_fd, std::string &log, int &exit_code) noexcept {
+		if (log_fd != -1 && !inner_receive_available(log_fd, log)) {
+			close(log_fd);
+			log_fd = -1;
+		}
+
+		if (pid_fd != -1) {
+			pollfd exit_poll { pid_fd, POLLIN, 0 };
+			if (poll(&exit_poll, 1, 0) <= 0) { return false; }
+			close(pid_fd);
+			pid_fd = -1;
+		}
+		else if (log_fd != -1) { return false; }
+
+		if (log_fd != -1) {
+			inner_receive_available(log_fd, log);
+			close(log_fd);
+			log_fd = -1;
+		}
+
+		error_t wait_error;
+		exit_code = inner_wait_for_command(pid, wait_error);
+		if (wait_error != error_t::SUCCESS) { exit_code = 127; }
+		return true;
+	}
+
+	struct inner_worker_job {
+		uint64_t connection;
+		uint64_t id;
+		uint32_t flags;
+		std::string cwd;
+		std::string cmdline;
+		std::vector<std::pair<std::string, std::string>> inputs;
+		std::vector<std::string> outputs;
+
+		std::string directory;
+		pid_t pid = -1;
+		int log_fd = -1;
+		int pid_fd = -1;
+	};
+
+	struct inner_worker_connection {
+		int fd;
+		std::string receive_buffer;
+		std::string send_buffer;
+	};
+
+	// NOTE: Runs a worker daemon on the given socket, never returns unless something goes wrong.
+	// At most capacity jobs run at the same time, the rest are queued in the order they came in.
+	// Jobs without a shared filesystem run in subdirectories of staging_directory.
+	inline void worker_serve(const lime::string &socket_path, unsigned int capacity, const lime::string &staging_directory, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		if (capacity == 0) { capacity = 1; }
+
+		sockaddr_un address { };
+		address.sun_family = AF_UNIX;
+		if (socket_path.length() >= sizeof(address.sun_path)) { error = error_t::SOCKET_FAILED; return; }
+		std::memcpy(address.sun_path, socket_path.c_str(), socket_path.length() + 1);
+
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (listen_fd < 0) { error = error_t::SOCKET_FAILED; return; }
+		unlink(socket_path.c_str());
+		if (bind(listen_fd, (const sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+			close(listen_fd);
+			error = error_t::SOCKET_FAILED;
+			return;
+		}
+
+		std::unordered_map<uint64_t, inner_worker_connection> connections;
+		uint64_t next_connection_id = 0;
+		std::deque<inner_worker_job> queued_jobs;
+		std::vector<inner_worker_job> running_jobs;
+
+		auto finish_job = [&](inner_worker_job &job, int exit_code) {
+			auto connection = connections.find(job.connection);
+			if (connection != connections.end()) {
+				if (exit_code == EXIT_SUCCESS && !(job.flags & REMOTE_JOB_SHARED_FILESYSTEM)) {
+					for (const std::string &output : job.outputs) {
+						std::string content;
+						if (!inner_read_file((job.directory + '/' + output).c_str(), content)) {
+							const std::string message = "[lime worker]: output \"" + output + "\" missing\n";
+							inner_frame_writer log_frame(connection->second.send_buffer, remote_frame_t::LOG);
+							log_frame.put(job.id);
+							log_frame.put_bytes(message);
+							exit_code = EXIT_FAILURE;
+							continue;
+						}
+						inner_frame_writer output_frame(connection->second.send_buffer, remote_frame_t::OUTPUT);
+						output_frame.put(job.id);
+						output_frame.put_bytes(output);
+						output_frame.put_bytes(content);
+					}
+				}
+				inner_frame_writer exit_frame(connection->second.send_buffer, remote_frame_t::EXIT);
+				exit_frame.put(job.id);
+				exit_frame.put((int32_t)exit_code);
+			}
+			if (!job.directory.empty()) { inner_remove_tree(job.directory.c_str()); }
+		};
+
+		auto start_job = [&](inner_worker_job &job) -> bool {
+			const char *working_directory = job.cwd.c_str();
+			if (!(job.flags & REMOTE_JOB_SHARED_FILESYSTEM)) {
+				job.directory = staging_directory.to_std_string() + "/job-" + std::to_string(job.connection) + '-' + std::to_string(job.id);
+				if (!inner_make_directories(job.directory)) { return false; }
+				for (const std::pair<std::string, std::string> &input : job.inputs) {
+					const std::string input_path = job.directory + '/' + input.first;
+					if (!inner_make_parent_directories(input_path)) { return false; }
+					if (!inner_write_file(input_path.c_str(), input.second)) { return false; }
+				}
+				job.inputs.clear();
+				for (const std::string &output : job.outputs) {
+					if (!inner_make_parent_directories(job.directory + '/' + output)) { return false; }
+				}
+				working_directory = job.directory.c_str();
+			}
+
+			int log_pipe[2];
+			if (pipe2(log_pipe, O_CLOEXEC) < 0) { return false; }
+
+			error_t spawn_error;
+			job.pid = inner_spawn_command(job.cmdline.c_str(), log_pipe[1], working_directory, spawn_error);
+			close(log_pipe[1]);
+			if (spawn_error != error_t::SUCCESS) { close(log_pipe[0]); return false; }
+
+			inner_set_nonblocking(log_pipe[0]);
+			job.log_fd = log_pipe[0];
+			job.pid_fd = inner_open_pidfd(job.pid);
+			return true;
+		};
+
+		auto parse_job = [&](uint64_t connection_id, inner_frame_reader &reader) -> bool {
+			inner_worker_job job;
+			job.connection = connection_id;
+			job.id = reader.get<uint64_t>();
+			job.flags = reader.get<uint32_t>();
+			job.cwd = reader.get_bytes();
+			job.cmdline = reader.get_bytes();
+			for (uint32_t i = reader.get<uint32_t>(); i > 0 && reader.is_valid(); i--) {
+				std::string input_path = reader.get_bytes();
+				std::string input_content = reader.get_bytes();
+				job.inputs.emplace_back(std::move(input_path), std::move(input_content));
+			}
+			for (uint32_t i = reader.get<uint32_t>(); i > 0 && reader.is_valid(); i--) {
+				job.outputs.push_back(reader.get_bytes());
+			}
+			if (!reader.is_valid()) { return false; }
+
+			if (!(job.flags & REMOTE_JOB_SHARED_FILESYSTEM)) {
+				for (const std::pair<std::string, std::string> &input : job.inputs) {
+					if (!inner_is_contained_relative_path(input.first)) { return false; }
+				}
+				for (const std::string &output : job.outputs) {
+					if (!inner_is_contained_relative_path(output)) { return false; }
+				}
+			}
+
+			queued_jobs.push_back(std::move(job));
+			return true;
+		};
+
+		auto drop_connection = [&](uint64_t connection_id) {
+			close(connections[connection_id].fd);
+			connections.erase(connection_id);
+			for (std::deque<inner_worker_job>::iterator it = queued_jobs.begin(); it != queued_jobs.end(); ) {
+				if (it->connection == connection_id) { it = queued_jobs.erase(it); }
+				else { it++; }
+			}
+			// NOTE: Nobody is going to pick up the results anymore, so there's no point in letting these run.
+			for (inner_worker_job &job : running_jobs) {
+				if (job.connection == connection_id) { kill(job.pid, SIGKILL); }
+			}
+		};
+
+		std::vector<pollfd> poll_fds;
+		std::vector<uint64_t> poll_connection_ids;
+		while (true) {
+			while (running_jobs.size() < capacity && !queued_jobs.empty()) {
+				inner_worker_job job = std::move(queued_jobs.front());
+				queued_jobs.pop_front();
+				if (start_job(job)) { running_jobs.push_back(std::move(job)); }
+				else { finish_job(job, 127); }
+			}
+
+			for (std::pair<const uint64_t, inner_worker_connection> &connection : connections) {
+				if (!connection.second.send_buffer.empty()) { inner_send_available(connection.second.fd, connection.second.send_buffer); }
+			}
+
+			poll_fds.clear();
+			poll_connection_ids.clear();
+			poll_fds.push_back({ listen_fd, POLLIN, 0 });
+			for (std::pair<const uint64_t, inner_worker_connection> &connection : connections) {
+				short events = POLLIN;
+				if (!connection.second.send_buffer.empty()) { events |= POLLOUT; }
+				poll_fds.push_back({ connection.second.fd, events, 0 });
+				poll_connection_ids.push_back(connection.first);
+			}
+			const size_t job_fds_start = poll_fds.size();
+			for (const inner_worker_job &job : running_jobs) {
+				poll_fds.push_back({ job.log_fd, POLLIN, 0 });
+				poll_fds.push_back({ job.pid_fd, POLLIN, 0 });
+			}
+
+			if (poll(poll_fds.data(), poll_fds.size(), -1) < 0) {
+				if (errno == EINTR) { continue; }
+				error = error_t::SOCKET_FAILED;
+				break;
+			}
+
+			// NOTE: Jobs go first, because finishing them can add frames for connections that get handled further down.
+			for (size_t i = running_jobs.size(); i > 0; i--) {
+				if (poll_fds[job_fds_start + 2 * (i - 1)].revents == 0 && poll_fds[job_fds_start + 2 * (i - 1) + 1].revents == 0) { continue; }
+				inner_worker_job &job = running_jobs[i - 1];
+
+				std::string log;
+				int exit_code;
+				bool exited = inner_poll_child(job.pid, job.log_fd, job.pid_fd, log, exit_code);
+				auto connection = connections.find(job.connection);
+				if (!log.empty() && connection != connections.end()) {
+					inner_frame_writer log_frame(connection->second.send_buffer, remote_frame_t::LOG);
+					log_frame.put(job.id);
+					log_frame.put_bytes(log);
+				}
+				if (!exited) { continue; }
+
+				finish_job(job, exit_code);
+				running_jobs.erase(running_jobs.begin() + (i - 1));
+			}
+
+			for (size_t i = 0; i < poll_connection_ids.size(); i++) {
+				const pollfd &connection_fd = poll_fds[i + 1];
+				if (connection_fd.revents == 0) { continue; }
+				const uint64_t connection_id = poll_connection_ids[i];
+				inner_worker_connection &connection = connections[connection_id];
+
+				bool still_open = inner_receive_available(connection.fd, connection.receive_buffer);
+				still_open &= inner_consume_frames(connection.receive_buffer, [&](remote_frame_t type, inner_frame_reader &reader) {
+					if (type != remote_frame_t::JOB) { return false; }
+					return parse_job(connection_id, reader);
+				});
+				if (connection_fd.revents & POLLOUT) { still_open &= inner_send_available(connection.fd, connection.send_buffer); }
+				if (!still_open) { drop_connection(connection_id); }
+			}
+
+			if (poll_fds[0].revents & POLLIN) {
+				int connection_fd;
+				while ((connection_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					inner_worker_connection &connection = connections[next_connection_id++];
+					connection.fd = connection_fd;
+					inner_frame_writer(connection.send_buffer, remote_frame_t::HELLO).put((uint32_t)capacity);
+				}
+			}
+		}
+
+		close(listen_fd);
+	}
+
+	inline void worker_serve(const lime::string &socket_path, unsigned int capacity, const lime::string &staging_directory) noexcept {
+		error_t error;
+		worker_serve(socket_path, capacity, staging_directory, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::SOCKET_FAILED:
+			lime::error("lime::worker_serve() failed, couldn't serve on socket \"" + socket_path + '\"');
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::worker_serve() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+	}
+
+	// NOTE: Client side of the worker protocol. Jobs are submitted first and then run all at once with run().
+	// Jobs go to whatever worker has the most free capacity. Once every worker is full, jobs run locally
+	// (up to local_capacity at once), and only once that's full too, they get pipelined into the workers' queues.
+	// If there are no workers or they all died, everything runs locally, so a build never depends on the workers being up.
+	class worker_pool {
+		// NOTE: How many jobs beyond its capacity a worker gets queued up, so it never idles waiting for the next frame.
+		static constexpr size_t PIPELINE_DEPTH = 2;
+
+		struct job_t {
+			lime::string cmdline;
+			std::vector<lime::string> inputs;
+			std::vector<lime::string> outputs;
+			int exit_code = -1;
+			bool finished = false;
+		};
+
+		struct worker_t {
+			lime::string socket_path;
+			int fd;
+			uint32_t capacity;
+			std::string receive_buffer;
+			std::string send_buffer;
+			std::vector<size_t> in_flight;
+		};
+
+		struct local_job_t {
+			size_t job;
+			pid_t pid;
+			int log_fd;
+			int pid_fd;
+		};
+
+		std::vector<job_t> jobs;
+		std::deque<size_t> queued_jobs;
+		std::vector<worker_t> workers;
+		std::vector<local_job_t> local_jobs;
+		size_t local_capacity;
+		size_t unfinished_jobs = 0;
+		bool shared_filesystem = true;
+		std::string cwd;
+
+		void finish_job(size_t job, int exit_code) noexcept {
+			jobs[job].exit_code = exit_code;
+			jobs[job].finished = true;
+			unfinished_jobs--;
+		}
+
+		void forward_log(const std::string &log) noexcept {
+			if (log.empty()) { return; }
+			if (fwrite(log.data(), sizeof(char), log.size(), stdout) < log.size()) {
+				lime::error("lime::worker_pool failed, fwrite failed");
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+
+		void start_local_job(size_t job) noexcept {
+			int log_pipe[2];
+			if (pipe2(log_pipe, O_CLOEXEC) < 0) { finish_job(job, 127); return; }
+
+			error_t error;
+			pid_t pid = inner_spawn_command(jobs[job].cmdline, log_pipe[1], nullptr, error);
+			close(log_pipe[1]);
+			if (error != error_t::SUCCESS) { close(log_pipe[0]); finish_job(job, 127); return; }
+
+			inner_set_nonblocking(log_pipe[0]);
+			local_jobs.push_back({ job, pid, log_pipe[0], inner_open_pidfd(pid) });
+		}
+
+		bool send_job_to_worker(worker_t &worker, size_t job) noexcept {
+			std::vector<std::pair<std::string, std::string>> inputs;
+			if (!shared_filesystem) {
+				for (const lime::string &input : jobs[job].inputs) {
+					std::string content;
+					if (!inner_read_file(input.c_str(), content)) {
+						lime::error("lime::worker_pool failed to read job input \"" + input + '\"');
+						return false;
+					}
+					inputs.emplace_back(input.to_std_string(), std::move(content));
+				}
+			}
+
+			inner_frame_writer job_frame(worker.send_buffer, remote_frame_t::JOB);
+			job_frame.put((uint64_t)job);
+			job_frame.put(shared_filesystem ? REMOTE_JOB_SHARED_FILESYSTEM : (uint32_t)0);
+			job_frame.put_bytes(cwd);
+			job_frame.put_bytes(jobs[job].cmdline.to_std_string());
+			job_frame.put((uint32_t)inputs.size());
+			for (const std::pair<std::string, std::string> &input : inputs) {
+				job_frame.put_bytes(input.first);
+				job_frame.put_bytes(input.second);
+			}
+			job_frame.put((uint32_t)jobs[job].outputs.size());
+			for (const lime::string &output : jobs[job].outputs) { job_frame.put_bytes(output.to_std_string()); }
+
+			worker.in_flight.push_back(job);
+			return true;
+		}
+
+		// NOTE: The jobs that the worker had are put back at the front of the queue, they'll run somewhere else.
+		void lose_worker(size_t worker_index) noexcept {
+			worker_t &worker = workers[worker_index];
+			lime::warn("lost worker \"" + worker.socket_path + "\", continuing without it");
+			close(worker.fd);
+			for (std::vector<size_t>::reverse_iterator it = worker.in_flight.rbegin(); it != worker.in_flight.rend(); it++) {
+				queued_jobs.push_front(*it);
+			}
+			workers.erase(workers.begin() + worker_index);
+		}
+
+		void schedule() noexcept {
+			while (!queued_jobs.empty()) {
+				worker_t *best_worker = nullptr;
+				for (worker_t &worker : workers) {
+					if (worker.in_flight.size() >= worker.capacity * PIPELINE_DEPTH) { continue; }
+					if (best_worker == nullptr || worker.in_flight.size() * best_worker->capacity < best_worker->in_flight.size() * worker.capacity) {
+						best_worker = &worker;
+					}
+				}
+				const bool worker_has_free_slot = best_worker != nullptr && best_worker->in_flight.size() < best_worker->capacity;
+
+				const size_t job = queued_jobs.front();
+				if (!worker_has_free_slot && local_jobs.size() < local_capacity) {
+					lime::cmd_label(jobs[job].cmdline);
+					start_local_job(job);
+				} else if (best_worker != nullptr) {
+					lime::cmd_label(jobs[job].cmdline);
+					if (!send_job_to_worker(*best_worker, job)) { finish_job(job, 127); }
+				} else { break; }
+				queued_jobs.pop_front();
+			}
+		}
+
+		bool handle_worker_frame(worker_t &worker, remote_frame_t type, inner_frame_reader &reader) noexcept {
+			const size_t job = reader.get<uint64_t>();
+			if (!reader.is_valid() || job >= jobs.size()) { return false; }
+
+			switch (type) {
+			case remote_frame_t::LOG:
+				forward_log(reader.get_bytes());
+				return true;
+
+			case remote_frame_t::OUTPUT:
+			{
+				const std::string output_path = reader.get_bytes();
+				const std::string content = reader.get_bytes();
+				if (!reader.is_valid()) { return false; }
+				// NOTE: The worker only gets to write the files the job said it would produce, nothing else.
+				bool is_declared_output = false;
+				for (const lime::string &output : jobs[job].outputs) { is_declared_output |= output.to_std_string() == output_path; }
+				if (!is_declared_output || !inner_is_contained_relative_path(output_path)) { return false; }
+				if (!inner_make_parent_directories(output_path) || !inner_write_file(output_path.c_str(), content)) {
+					lime::error("lime::worker_pool failed to write job output \"" + output_path + '\"');
+				}
+				return true;
+			}
+
+			case remote_frame_t::EXIT:
+			{
+				const int32_t exit_code = reader.get<int32_t>();
+				for (std::vector<size_t>::iterator it = worker.in_flight.begin(); it != worker.in_flight.end(); it++) {
+					if (*it != job) { continue; }
+					worker.in_flight.erase(it);
+					finish_job(job, exit_code);
+					return true;
+				}
+				return false;
+			}
+
+			default: return false;
+			}
+		}
+
+	public:
+		worker_pool(unsigned int local_capacity) noexcept : local_capacity(local_capacity == 0 ? 1 : local_capacity) { }
+
+		worker_pool(const worker_pool&) = delete;
+		worker_pool& operator=(const worker_pool&) = delete;
+
+		~worker_pool() noexcept {
+			for (const worker_t &worker : workers) { close(worker.fd); }
+		}
+
+		void set_shared_filesystem(bool value) noexcept { shared_filesystem = value; }
+
+		bool add_worker(const lime::string &socket_path, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			int fd = inner_connect_unix_socket(socket_path, error);
+			if (error != error_t::SUCCESS) { return false; }
+
+			// NOTE: The worker always starts out by telling us its capacity. Blocking on that is fine, it's local.
+			std::string receive_buffer;
+			uint32_t capacity = 0;
+			while (capacity == 0) {
+				char chunk[256];
+				ssize_t bytes_read = read(fd, chunk, sizeof(chunk));
+				if (bytes_read < 0 && errno == EINTR) { continue; }
+				if (bytes_read <= 0) { close(fd); error = error_t::SOCKET_FAILED; return false; }
+				receive_buffer.append(chunk, bytes_read);
+
+				bool valid = inner_consume_frames(receive_buffer, [&](remote_frame_t type, inner_frame_reader &reader) {
+					if (type != remote_frame_t::HELLO || capacity != 0) { return false; }
+					capacity = reader.get<uint32_t>();
+					return capacity != 0;
+				});
+				if (!valid) { close(fd); error = error_t::PROTOCOL_INVALID; return false; }
+			}
+
+			inner_set_nonblocking(fd);
+			workers.push_back({ socket_path, fd, capacity, std::move(receive_buffer), std::string(), std::vector<size_t>() });
+			return true;
+		}
+
+		// NOTE: Not being able to reach a worker isn't fatal, we just run more locally.
+		bool add_worker(const lime::string &socket_path) noexcept {
+			error_t error;
+			if (add_worker(socket_path, error)) { return true; }
+			lime::warn("couldn't connect to worker \"" + socket_path + "\", jobs will run locally instead");
+			return false;
+		}
+
+		// NOTE: inputs are only sent and outputs only retrieved when the workers don't share our filesystem.
+		// Both have to be relative paths inside of the cwd in that case.
+		size_t submit(const lime::string &cmdline, std::vector<lime::string> inputs = { }, std::vector<lime::string> outputs = { }) noexcept {
+			jobs.push_back({ cmdline, std::move(inputs), std::move(outputs) });
+			queued_jobs.push_back(jobs.size() - 1);
+			unfinished_jobs++;
+			return jobs.size() - 1;
+		}
+
+		int get_exit_code(size_t job) const noexcept {
+			if (job >= jobs.size() || !jobs[job].finished) {
+				lime::error("lime::worker_pool::get_exit_code(job) called with invalid or unfinished job");
+				lime::exit_program(EXIT_FAILURE);
+			}
+			return jobs[job].exit_code;
+		}
+
+		void run(error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			cwd = lime::pwd().to_std_string();
+
+			std::vector<pollfd> poll_fds;
+			while (unfinished_jobs != 0) {
+				schedule();
+
+				for (size_t i = workers.size(); i > 0; i--) {
+					if (!inner_send_available(workers[i - 1].fd, workers[i - 1].send_buffer)) { lose_worker(i - 1); }
+				}
+
+				poll_fds.clear();
+				for (const worker_t &worker : workers) {
+					short events = POLLIN;
+					if (!worker.send_buffer.empty()) { events |= POLLOUT; }
+					poll_fds.push_back({ worker.fd, events, 0 });
+				}
+				for (const local_job_t &local_job : local_jobs) {
+					poll_fds.push_back({ local_job.log_fd, POLLIN, 0 });
+					poll_fds.push_back({ local_job.pid_fd, POLLIN, 0 });
+				}
+				if (poll_fds.empty()) { continue; }
+
+				int poll_result;
+				{
+					inner_wait_timer wait_timer;
+					poll_result = poll(poll_fds.data(), poll_fds.size(), -1);
+				}
+				if (poll_result < 0) {
+					if (errno == EINTR) { continue; }
+					lime::bug("lime::worker_pool::run() failed, poll failed");
+					lime::exit_program(EXIT_FAILURE);
+				}
+
+				const size_t worker_count = workers.size();
+				for (size_t i = local_jobs.size(); i > 0; i--) {
+					if (poll_fds[worker_count + 2 * (i - 1)].revents == 0 && poll_fds[worker_count + 2 * (i - 1) + 1].revents == 0) { continue; }
+					local_job_t &local_job = local_jobs[i - 1];
+
+					std::string log;
+					int exit_code;
+					bool exited = inner_poll_child(local_job.pid, local_job.log_fd, local_job.pid_fd, log, exit_code);
+					forward_log(log);
+					if (!exited) { continue; }
+
+					finish_job(local_job.job, exit_code);
+					local_jobs.erase(local_jobs.begin() + (i - 1));
+				}
+
+				for (size_t i = worker_count; i > 0; i--) {
+					if (poll_fds[i - 1].revents == 0) { continue; }
+					worker_t &worker = workers[i - 1];
+
+					bool still_open = inner_receive_available(worker.fd, worker.receive_buffer);
+					still_open &= inner_consume_frames(worker.receive_buffer, [&](remote_frame_t type, inner_frame_reader &reader) {
+						return handle_worker_frame(worker, type, reader);
+					});
+					if (!still_open) { lose_worker(i - 1); }
+				}
+			}
+
+			fflush(stdout);
+
+			for (const job_t &job : jobs) {
+				if (job.exit_code != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; }
+			}
+		}
+
+		void run() noexcept {
+			error_t error;
+			run(error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::CMD_RETURNED_FAILURE:
+				lime::error("lime::worker_pool::run() failed, one or more jobs failed");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::worker_pool::run() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+	};
+
+	// NOTE: Same lookup that execvp does. Names with a slash in them are taken as-is.
+	inline std::string inner_find_executable(const std::string &name) noexcept {
+		if (name.find('/') != std::string::npos) { return access(name.c_str(), X_OK) == 0 ? name : std::string(); }
+
+		const char *path_variable = std::getenv("PATH");
+		if (path_variable == nullptr) { return std::string(); }
+
+		for (const char *start = path_variable; ; ) {
+			const char *end = std::strchr(start, ':');
+			if (end == nullptr) { end = start + std::strlen(start); }
+
+			std::string candidate(start, end);
+			if (candidate.empty()) { candidate = "."; }
+			candidate += '/';
+			candidate += name;
+			if (access(candidate.c_str(), X_OK) == 0) { return candidate; }
+
+			if (*end == '\0') { return std::string(); }
+			start = end + 1;
+		}
+	}
+
+	// NOTE: Everything a build script usually wants to know about a compiler, probed once and then cached
+	// in the build directory. The cache entry is keyed on the compiler's path, inode, size and mtime,
+	// so installing a different compiler under the same name invalidates it.
+	// Loading a valid cache entry costs one stat and one small file read, no compiler gets spawned.
+	// Flag support is probed lazily, the first time somebody asks about a specific flag, and then cached as well.
+	class toolchain {
+		static constexpr const char *CACHE_FILENAME = ".lime_toolchain_cache";
+
+		std::string compiler_path;
+		std::string build_directory;
+
+		struct key_t {
+			unsigned long long device;
+			unsigned long long inode;
+			long long size;
+			long long mtime_seconds;
+			long long mtime_nanoseconds;
+
+			bool operator==(const key_t &other) const noexcept = default;
+		} key { };
+
+		std::string version;
+		std::string target_triple;
+		std::unordered_map<std::string, bool> flag_support;
+
+		// NOTE: Entries for other compilers in the same cache file, kept as-is so saving doesn't drop them.
+		std::vector<std::string> other_entries;
+
+		std::string get_cache_path() const noexcept { return build_directory + '/' + CACHE_FILENAME; }
+
+		std::string serialize() const noexcept {
+			std::string result = "compiler " + compiler_path + '\n';
+			result += "key " + std::to_string(key.device) + ' ' + std::to_string(key.inode) + ' ' + std::to_string(key.size)
+				+ ' ' + std::to_string(key.mtime_seconds) + ' ' + std::to_string(key.mtime_nanoseconds) + '\n';
+			result += "version " + version + '\n';
+			result += "target " + target_triple + '\n';
+			for (const std::pair<const std::string, bool> &flag : flag_support) {
+				result += flag.second ? "flag 1 " : "flag 0 ";
+				result += flag.first + '\n';
+			}
+			return result;
+		}
+
+		// NOTE: Returns true if there was a matching entry for our compiler with the same key.
+		bool load_cache() noexcept {
+			std::string content;
+			if (!inner_read_file(get_cache_path().c_str(), content)) { return false; }
+
+			bool found = false;
+			bool inside_our_entry = false;
+			inner_for_each_line(content, [&](const std::string &line) {
+				if (line.compare(0, 9, "compiler ") == 0) {
+					inside_our_entry = line.compare(9, std::string::npos, compiler_path) == 0;
+					if (!inside_our_entry) { other_entries.push_back(std::string()); }
+				}
+				if (!inside_our_entry) {
+					if (!other_entries.empty()) { other_entries.back() += line + '\n'; }
+					return;
+				}
+
+				if (line.compare(0, 4, "key ") == 0) {
+					key_t cached_key { };
+					if (std::sscanf(line.c_str() + 4, "%llu %llu %lld %lld %lld", &cached_key.device, &cached_key.inode,
+							&cached_key.size, &cached_key.mtime_seconds, &cached_key.mtime_nanoseconds) != 5) { return; }
+					found = cached_key == key;
+				}
+				else if (!found) { return; }
+				else if (line.compare(0, 8, "version ") == 0) { version = line.substr(8); }
+				else if (line.compare(0, 7, "target ") == 0) { target_triple = line.substr(7); }
+				else if (line.compare(0, 5, "flag ") == 0 && line.size() > 7) { flag_support[line.substr(7)] = line[5] == '1'; }
+			});
+
+			if (!found) {
+				version.clear();
+				target_triple.clear();
+				flag_support.clear();
+			}
+			return found;
+		}
+
+		void save_cache() const noexcept {
+			std::string content;
+			for (const std::string &entry : other_entries) { content += entry; }
+			content += serialize();
+
+			if (!inner_atomic_write_file(get_cache_path(), content)) {
+				lime::warn("lime::toolchain failed to write cache file \"" + get_cache_path() + "\", probes will be repeated next run");
+			}
+		}
+
+		std::string quoted_compiler_path() const noexcept { return '\"' + compiler_path + '\"'; }
+
+		bool run_probes(error_t &error) noexcept {
+			std::string output;
+
+			int exit_code = inner_capture_command(quoted_compiler_path() + " --version", output, error);
+			if (error != error_t::SUCCESS) { return false; }
+			if (exit_code != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; return false; }
+			version = output.substr(0, output.find('\n'));
+
+			exit_code = inner_capture_command(quoted_compiler_path() + " -dumpmachine", output, error);
+			if (error != error_t::SUCCESS) { return false; }
+			if (exit_code != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; return false; }
+			target_triple = output.substr(0, output.find('\n'));
+
+			return true;
+		}
+
+		// NOTE: The flag gets a full compile and link of an empty program, that way linker flags like -fuse-ld are tested too.
+		// -Werror because some compilers only warn about flags they don't know.
+		bool probe_flag(const std::string &flag) const noexcept {
+			// NOTE: Per process, so concurrent builds in the same build directory don't probe with each other's files.
+			const std::string probe_path = build_directory + "/.lime_probe." + std::to_string(getpid());
+			const std::string source_path = probe_path + ".cpp";
+			const std::string binary_path = probe_path + ".out";
+			if (!inner_write_file(source_path.c_str(), "int main() { }\n")) { return false; }
+
+			std::string output;
+			error_t error;
+			int exit_code = inner_capture_command(quoted_compiler_path() + " -Werror " + flag
+					+ " -x c++ \"" + source_path + "\" -o \"" + binary_path + '\"', output, error);
+
+			unlink(source_path.c_str());
+			unlink(binary_path.c_str());
+			return error == error_t::SUCCESS && exit_code == EXIT_SUCCESS;
+		}
+
+	public:
+		static toolchain probe(const lime::string &compiler, const lime::string &build_directory, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			toolchain result;
+			result.compiler_path = inner_find_executable(compiler.to_std_string());
+			if (result.compiler_path.empty()) { error = error_t::EXECUTABLE_NOT_FOUND; return toolchain(); }
+			result.build_directory = build_directory.to_std_string();
+
+			struct stat stat_buf;
+			if (inner_stat(result.compiler_path.c_str(), &stat_buf) < 0) { error = error_t::ERRNO; return toolchain(); }
+			result.key = { (unsigned long long)stat_buf.st_dev, (unsigned long long)stat_buf.st_ino, (long long)stat_buf.st_size,
+					(long long)stat_buf.st_mtim.tv_sec, (long long)stat_buf.st_mtim.tv_nsec };
+
+			if (result.load_cache()) { return result; }
+
+			if (!result.run_probes(error)) { return toolchain(); }
+			if (!inner_make_directories(result.build_directory)) { error = error_t::ERRNO; return toolchain(); }
+			result.save_cache();
+			return result;
+		}
+
+		static toolchain probe(const lime::string &compiler, const lime::string &build_directory) noexcept {
+			error_t error;
+			toolchain result = probe(compiler, build_directory, error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::EXECUTABLE_NOT_FOUND:
+				lime::error("lime::toolchain::probe() failed, compiler \"" + compiler + "\" not found");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_INVOKE_FAILED:
+			case error_t::CMD_RETURNED_FAILURE:
+				lime::error("lime::toolchain::probe() failed, couldn't query compiler \"" + compiler + '\"');
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::ERRNO:
+				lime::error("lime::toolchain::probe() failed, see errno");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::toolchain::probe() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			return result;
+		}
+
+		lime::string get_path() const noexcept { return compiler_path; }
+
+		// NOTE: The first line of --version, for example "g++ (Debian 12.2.0-14) 12.2.0".
+		lime::string get_version_string() const noexcept { return version; }
+
+		bool is_clang() const noexcept { return version.find("clang") != std::string::npos; }
+
+		// NOTE: What the compiler calls its module interface files (BMIs). gcc keeps them in gcm.cache by default.
+		lime::string get_bmi_extension() const noexcept { return is_clang() ? ".pcm" : ".gcm"; }
+		lime::string get_default_bmi_directory() const noexcept { return is_clang() ? build_directory + "/pcm.cache" : std::string("gcm.cache"); }
+
+		// NOTE: The last thing in the version line that looks like major.minor.patch, which is where both gcc and clang put it.
+		// Missing components are 0.
+		void get_version(unsigned int &major, unsigned int &minor, unsigned int &patch) const noexcept {
+			major = minor = patch = 0;
+			for (size_t i = 0; i < version.size(); i++) {
+				if (version[i] < '0' || version[i] > '9' || (i != 0 && version[i - 1] != ' ' && version[i - 1] != '-')) { continue; }
+				unsigned int parsed_major = 0, parsed_minor = 0, parsed_patch = 0;
+				if (std::sscanf(version.c_str() + i, "%u.%u.%u", &parsed_major, &parsed_minor, &parsed_patch) >= 2) {
+					major = parsed_major;
+					minor = parsed_minor;
+					patch = parsed_patch;
+				}
+			}
+		}
+
+		unsigned int get_version_major() const noexcept {
+			unsigned int major, minor, patch;
+			get_version(major, minor, patch);
+			return major;
+		}
+
+		// NOTE: What -dumpmachine says, for example "x86_64-linux-gnu".
+		lime::string get_target_triple() const noexcept { return target_triple; }
+
+		// NOTE: Probes the flag the first time it's asked about and caches the answer, also on disk.
+		bool supports_flag(const lime::string &flag) noexcept {
+			auto cached = flag_support.find(flag.to_std_string());
+			if (cached != flag_support.end()) { return cached->second; }
+
+			const bool supported = probe_flag(flag.to_std_string());
+			flag_support[flag.to_std_string()] = supported;
+			save_cache();
+			return supported;
+		}
+
+		// NOTE: Convenience for the common pattern of picking the first flag out of a list that works,
+		// for example { "-std=c++23", "-std=c++2b", "-std=c++20" }. Returns an empty string if none do.
+		lime::string first_supported_flag(const std::vector<lime::string> &flags) noexcept {
+			for (const lime::string &flag : flags) {
+				if (supports_flag(flag)) { return flag; }
+			}
+			return lime::string();
+		}
+
+		// NOTE: The fastest linker the compiler can be pointed at with -fuse-ld, in the order mold, lld, gold.
+		// Returns an empty string if none of them work, then the compiler's default linker is the only option.
+		// Like every other flag probe, this only links something the first time and is cached after that.
+		lime::string get_fast_linker() noexcept {
+			for (const char *linker : { "mold", "lld", "gold" }) {
+				if (supports_flag(lime::string("-fuse-ld=") + linker)) { return linker; }
+			}
+			return lime::string();
+		}
+
+		// NOTE: The flags for linking with the given linker (one of get_fast_linker()'s answers) on thread_count threads.
+		// The thread options get probed too, because not every build of every linker has them.
+		lime::string get_linker_flags(const lime::string &linker, unsigned int thread_count) noexcept {
+			if (linker.length() == 0) { return lime::string(); }
+
+			const lime::string use_linker_flag = "-fuse-ld=" + linker;
+			const lime::string count(std::to_string(thread_count));
+			std::vector<lime::string> thread_flags;
+			if (linker == "gold") { thread_flags.push_back("-Wl,--threads -Wl,--thread-count=" + count); }
+			else { thread_flags.push_back("-Wl,--threads=" + count); }
+			if (linker == "mold") { thread_flags.push_back("-Wl,--thread-count=" + count); }
+
+			for (const lime::string &thread_flag : thread_flags) {
+				if (supports_flag(use_linker_flag + ' ' + thread_flag)) { return use_linker_flag + ' ' + thread_flag; }
+			}
+			return use_linker_flag;
+		}
+	};
+
+	// NOTE: Read-only memory mapping of a whole file. Empty files don't get mapped, data() is nullptr for them.
+	class inner_mapped_file {
+		const char *mapping = nullptr;
+		size_t mapping_size = 0;
+
+	public:
+		inner_mapped_file() noexcept = default;
+
+		inner_mapped_file(const inner_mapped_file&) = delete;
+		inner_mapped_file& operator=(const inner_mapped_file&) = delete;
+
+		~inner_mapped_file() noexcept {
+			if (mapping != nullptr) { munmap((void*)mapping, mapping_size); }
+		}
+
+		bool open(const char *path) noexcept {
+			int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0) { return false; }
+
+			struct stat stat_buf;
+			if (inner_fstat(fd, &stat_buf) < 0) { close(fd); return false; }
+
+			mapping_size = stat_buf.st_size;
+			if (mapping_size != 0) {
+				void *result = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (result == MAP_FAILED) { close(fd); mapping_size = 0; return false; }
+				mapping = (const char*)result;
+			}
+
+			close(fd);
+			return true;
+		}
+
+		const char* data() const noexcept { return mapping; }
+		size_t size() const noexcept { return mapping_size; }
+	};
+
+	// NOTE: Resolves "." and ".." elements and duplicate slashes without asking the filesystem.
+	// Good enough for building lookup keys, symlinks pointing upwards are the only thing it gets wrong.
+	inline std::string inner_lexically_normalize(const std::string &path) noexcept {
+		std::vector<std::string> elements;
+		size_t leading_parent_elements = 0;
+		for (size_t start = 0; start <= path.size(); ) {
+			size_t slash = path.find('/', start);
+			if (slash == std::string::npos) { slash = path.size(); }
+			const std::string element = path.substr(start, slash - start);
+			start = slash + 1;
+
+			if (element.empty() || element == ".") { continue; }
+			if (element == "..") {
+				if (!elements.empty()) { elements.pop_back(); }
+				else if (path[0] != '/') { leading_parent_elements++; }
+				continue;
+			}
+			elements.push_back(element);
+		}
+
+		std::string result = path[0] == '/' ? "/" : "";
+		for (; leading_parent_elements > 0; leading_parent_elements--) { result += "../"; }
+		for (const std::string &element : elements) { result += element; result += '/'; }
+		if (result.size() > 1) { result.pop_back(); }
+		if (result.empty()) { result = "."; }
+		return result;
+	}
+
+	// NOTE: Relative paths are taken relative to the cwd at the time of the call.
+	inline std::string inner_absolute_normalize(const std::string &path) noexcept {
+		if (path.empty() || path[0] != '/') { return inner_lexically_normalize(lime::pwd().to_std_string() + '/' + path); }
+		return inner_lexically_normalize(path);
+	}
+
+	struct inner_include_directive {
+		std::string name;
+		bool angled;
+		bool is_next;
+	};
+
+	// NOTE: Skips the comment, string literal or character literal that starts at head, which points at a '/', '"' or '\''.
+	// Returns where scanning should continue, head + 1 if there's nothing to skip, or nullptr if the input ends inside of it.
+	// A line comment (or an unterminated literal) stops in front of the newline that ends it, so line-based scanners still see that.
+	inline const char *inner_skip_comment_or_literal(const char *head, const char *begin, const char *end) noexcept {
+		switch (*head) {
+		case '/':
+			if (end - head >= 2 && head[1] == '/') {
+				// NOTE: Line comments can be continued with a backslash at the end of the line, rare but legal.
+				do {
+					head = (const char*)std::memchr(head + 1, '\n', end - head - 1);
+					if (head == nullptr) { return nullptr; }
+				} while (head[-1] == '\\');
+				return head;
+			}
+			if (end - head >= 2 && head[1] == '*') {
+				for (head += 2; ; head++) {
+					head = (const char*)std::memchr(head, '*', end - head);
+					if (head == nullptr || end - head < 2) { return nullptr; }
+					if (head[1] == '/') { return head + 2; }
+				}
+			}
+			return head + 1;
+
+		case '\'':
+			// NOTE: Digit separators (1'000'000) aren't character literals.
+			if (head != begin && head[-1] >= '0' && head[-1] <= '9' && !(head - begin >= 2 && head[-1] == '8' && head[-2] == 'u')) { return head + 1; }
+			[[fallthrough]];
+		case '\"':
+		{
+			const char quote = *head;
+			// NOTE: Raw string literals, R"delimiter( ... )delimiter", don't have escapes and can span lines.
+			if (quote == '\"' && head != begin && head[-1] == 'R') {
+				const char *delimiter_end = (const char*)std::memchr(head, '(', end - head);
+				if (delimiter_end == nullptr) { return nullptr; }
+				const std::string terminator = ')' + std::string(head + 1, delimiter_end) + '\"';
+				const char *terminator_position = std::search(delimiter_end, end, terminator.begin(), terminator.end());
+				if (terminator_position == end) { return nullptr; }
+				return terminator_position + terminator.size();
+			}
+			for (head++; head < end && *head != quote && *head != '\n'; head++) {
+				if (*head == '\\') { head++; }
+			}
+			if (head < end && *head == quote) { head++; }
+			return head;
+		}
+
+		default:
+			return head + 1;
+		}
+	}
+
+	// NOTE: Finds every #include in the source, skipping comments, string literals and character literals.
+	// Conditional compilation isn't evaluated, so includes inside of #if 0 and friends count too.
+	// That only ever makes the dependency list bigger, never smaller, so at worst something gets rebuilt
+	// that didn't need to be.
+	inline void inner_scan_includes(const char *head, const char *end, std::vector<inner_include_directive> &result) noexcept {
+		const char *const begin = head;
+
+		auto skip_horizontal_whitespace = [&end](const char *position) {
+			while (position < end && (*position == ' ' || *position == '\t')) { position++; }
+			return position;
+		};
+
+		while ((head = inner_find_any_of(head, end, '#', '/', '\"', '\'')) < end) {
+			switch (*head) {
+			case '/':
+			case '\'':
+			case '\"':
+				head = inner_skip_comment_or_literal(head, begin, end);
+				if (head == nullptr) { return; }
+				continue;
+
+			case '#':
+			{
+				// NOTE: Only a # that is the first thing on its line starts a directive.
+				const char *line_start = head;
+				while (line_start != begin && (line_start[-1] == ' ' || line_start[-1] == '\t')) { line_start--; }
+				head++;
+				if (line_start != begin && line_start[-1] != '\n') { continue; }
+
+				head = skip_horizontal_whitespace(head);
+				const char *directive_start = head;
+				while (head < end && ((*head >= 'a' && *head <= 'z') || *head == '_')) { head++; }
+				const std::string_view directive(directive_start, head - directive_start);
+				if (directive != "include" && directive != "include_next" && directive != "import") { continue; }
+
+				head = skip_horizontal_whitespace(head);
+				if (head == end || (*head != '<' && *head != '\"')) { continue; }		// NOTE: Computed includes, can't do anything about those.
+
+				const char closing = *head == '<' ? '>' : '\"';
+				const char *name_start = head + 1;
+				const char *name_end = name_start;
+				while (name_end < end && *name_end != closing && *name_end != '\n') { name_end++; }
+				if (name_end == end || *name_end != closing) { continue; }
+
+				result.push_back({ std::string(name_start, name_end), closing == '>', directive == "include_next" });
+				head = name_end + 1;
+				continue;
+			}
+			}
+		}
+	}
+
+	// NOTE: Bump allocator for data that lives as long as the build run does. Nothing gets freed individually,
+	// everything goes away at once when the arena does. Allocations are a pointer bump most of the time,
+	// and small things end up next to each other in memory instead of all over the heap.
+	class arena {
+		static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+		std::vector<char*> chunks;
+		char *head = nullptr;
+		char *end = nullptr;
+
+	public:
+		arena() noexcept = default;
+
+		arena(const arena&) = delete;
+		arena& operator=(const arena&) = delete;
+
+		~arena() noexcept {
+			for (char *chunk : chunks) { delete[] chunk; }
+		}
+
+		void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) noexcept {
+			char *aligned_head = (char*)(((uintptr_t)head + alignment - 1) & ~(uintptr_t)(alignment - 1));
+			if (head == nullptr || aligned_head + size > end) {
+				// NOTE: Big allocations get a chunk of their own, so they don't waste the rest of the current one.
+				const size_t chunk_size = size + alignment > CHUNK_SIZE ? size + alignment : CHUNK_SIZE;
+				char *chunk = new (std::nothrow) char[chunk_size];
+				if (chunk == nullptr) {
+					lime::error("lime::arena::allocate() failed, out of memory");
+					lime::exit_program(EXIT_FAILURE);
+				}
+				chunks.push_back(chunk);
+				if (chunk_size != CHUNK_SIZE) {
+					return (void*)(((uintptr_t)chunk + alignment - 1) & ~(uintptr_t)(alignment - 1));
+				}
+				head = chunk;
+				end = chunk + chunk_size;
+				aligned_head = (char*)(((uintptr_t)head + alignment - 1) & ~(uintptr_t)(alignment - 1));
+			}
+			head = aligned_head + size;
+			return aligned_head;
+		}
+
+		std::string_view store(std::string_view string) noexcept {
+			char *result = (char*)allocate(string.size(), 1);
+			std::memcpy(result, string.data(), string.size());
+			return std::string_view(result, string.size());
+		}
+	};
+
+	using path_id_t = uint32_t;
+
+	// NOTE: Stores every distinct path exactly once for the whole run and hands out 32-bit IDs for them.
+	// Paths are stored as a tree of (parent ID, name) pairs, so "/home/user/project/src" only exists once,
+	// no matter how many thousands of files are under it, and the names themselves live in an arena.
+	// The same path always gets the same ID, so comparing paths is comparing integers and hashing a path
+	// is free. Graph nodes, stat cache entries and dependency lists can all be plain arrays of IDs.
+	// All paths are absolute and lexically normalized while they're interned. The cwd that relative paths
+	// are resolved against is looked up once and kept as an ID, until the next lime::cd().
+	class path_table {
+		struct node_t {
+			path_id_t parent;
+			std::string_view name;
+		};
+
+		struct key_t {
+			path_id_t parent;
+			std::string_view name;
+
+			bool operator==(const key_t &other) const noexcept = default;
+		};
+
+		struct key_hash_t {
+			size_t operator()(const key_t &key) const noexcept {
+				return std::hash<std::string_view>()(key.name) ^ ((size_t)key.parent * 0x9e3779b97f4a7c15ull);
+			}
+		};
+
+		lime::arena names;
+		std::vector<node_t> nodes { { ROOT, std::string_view() } };
+		std::unordered_map<key_t, path_id_t, key_hash_t> lookup;
+
+		path_id_t cwd = ROOT;
+		uint64_t cwd_generation = UINT64_MAX;
+
+	public:
+		// NOTE: The ID of "/", which is its own parent.
+		static constexpr path_id_t ROOT = 0;
+
+		path_table() noexcept = default;
+
+		path_table(const path_table&) = delete;
+		path_table& operator=(const path_table&) = delete;
+
+		path_id_t intern_child(path_id_t parent, std::string_view name) noexcept {
+			if (parent >= nodes.size()) {
+				lime::bug("lime::path_table::intern_child() failed, invalid parent ID");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			auto existing = lookup.find({ parent, name });
+			if (existing != lookup.end()) { return existing->second; }
+
+			if (nodes.size() == UINT32_MAX) {
+				lime::error("lime::path_table ran out of IDs");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			const path_id_t id = nodes.size();
+			const std::string_view stored_name = names.store(name);
+			nodes.push_back({ parent, stored_name });
+			lookup.emplace(key_t { parent, stored_name }, id);
+			return id;
+		}
+
+		// NOTE: Resolves path relative to the directory base, unless it's absolute. "." and ".." are resolved lexically,
+		// like inner_lexically_normalize() does, ".." of "/" is "/".
+		path_id_t intern_relative(path_id_t base, std::string_view path) noexcept {
+			path_id_t result = !path.empty() && path[0] == '/' ? ROOT : base;
+			for (size_t start = 0; start < path.size(); ) {
+				size_t slash = path.find('/', start);
+				if (slash == std::string_view::npos) { slash = path.size(); }
+				const std::string_view name = path.substr(start, slash - start);
+				start = slash + 1;
+
+				if (name.empty() || name == ".") { continue; }
+				if (name == "..") { result = nodes[result].parent; continue; }
+				result = intern_child(result, name);
+			}
+			return result;
+		}
+
+		// NOTE: Relative paths are taken relative to the cwd.
+		path_id_t intern(const lime::string &path) noexcept {
+			const std::string_view path_view(path.c_str(), path.length());
+			if (!path_view.empty() && path_view[0] == '/') { return intern_relative(ROOT, path_view); }
+			return intern_relative(get_cwd(), path_view);
+		}
+
+		path_id_t get_cwd() noexcept {
+			if (cwd_generation != inner_cwd_generation) {
+				cwd = intern_relative(ROOT, lime::pwd().to_std_string());
+				cwd_generation = inner_cwd_generation;
+			}
+			return cwd;
+		}
+
+		path_id_t get_parent(path_id_t id) const noexcept { return nodes[id].parent; }
+		std::string_view get_name(path_id_t id) const noexcept { return nodes[id].name; }
+		size_t size() const noexcept { return nodes.size(); }
+
+		lime::string to_string(path_id_t id) const noexcept {
+			if (id == ROOT) { return "/"; }
+
+			size_t length = 0;
+			for (path_id_t element = id; element != ROOT; element = nodes[element].parent) { length += nodes[element].name.size() + 1; }
+
+			std::string result(length, '/');
+			for (path_id_t element = id; element != ROOT; element = nodes[element].parent) {
+				length -= nodes[element].name.size();
+				std::memcpy(result.data() + length, nodes[element].name.data(), nodes[element].name.size());
+				length--;
+			}
+			return result;
+		}
+	};
+
+	// NOTE: Finds the headers a translation unit depends on without running the compiler, so the dependency
+	// information is there even for the very first build of a fresh checkout.
+	// Quoted includes are looked up relative to the including file first and in the include directories after that,
+	// angled includes only in the include directories. Includes that can't be resolved are assumed to be
+	// system headers and are left out.
+	// Every file is only ever scanned once per include_scanner, so headers shared between translation units are cheap,
+	// and every (directory, name) lookup is only ever done once too.
+	class include_scanner {
+		// NOTE: Every file and directory the scanner touches is interned, so all of the bookkeeping below is keyed by
+		// integers, and resolving an include is walking its name from the directory's ID instead of building and normalizing strings.
+		path_table table;
+
+		std::vector<path_id_t> include_directories;
+
+		enum class lookup_t : uint8_t { UNKNOWN, FILE, NOT_FILE };
+
+		// NOTE: Path ID -> whether it's a regular file, every path gets stat-ed at most once.
+		std::vector<lookup_t> lookups;
+
+		// NOTE: file -> resolved direct includes of that file.
+		std::unordered_map<path_id_t, std::vector<path_id_t>> scanned_files;
+
+		// NOTE: file -> index of the include directory it was found in, #include_next inside of it continues after that one.
+		std::unordered_map<path_id_t, size_t> found_in_directory;
+
+		// NOTE: Returns the ID of directory/name if that's a regular file, path_table::ROOT otherwise.
+		path_id_t lookup(path_id_t directory, const std::string &name) noexcept {
+			const path_id_t file = table.intern_relative(directory, name);
+			if (file >= lookups.size()) { lookups.resize(table.size(), lookup_t::UNKNOWN); }
+
+			if (lookups[file] == lookup_t::UNKNOWN) {
+				struct stat stat_buf;
+				const bool exists = inner_stat(table.to_string(file).c_str(), &stat_buf) == 0 && S_ISREG(stat_buf.st_mode);
+				lookups[file] = exists ? lookup_t::FILE : lookup_t::NOT_FILE;
+			}
+			return lookups[file] == lookup_t::FILE ? file : path_table::ROOT;
+		}
+
+		const std::vector<path_id_t>& scan(path_id_t file) noexcept {
+			auto cached = scanned_files.find(file);
+			if (cached != scanned_files.end()) { return cached->second; }
+
+			std::vector<path_id_t> &resolved_includes = scanned_files[file];
+
+			const lime::string file_path = table.to_string(file);
+			inner_mapped_file mapped_file;
+			if (!mapped_file.open(file_path.c_str())) {
+				lime::warn("lime::include_scanner couldn't read \"" + file_path + "\", its includes are unknown");
+				return resolved_includes;
+			}
+
+			std::vector<inner_include_directive> includes;
+			inner_scan_includes(mapped_file.data(), mapped_file.data() + mapped_file.size(), includes);
+
+			const path_id_t file_directory = table.get_parent(file);
+
+			// NOTE: Files that weren't found through the include directories (the source itself, quoted includes next to their includer)
+			// continue after the include directory they're in, if any, and search all of them otherwise, like the compilers do.
+			size_t next_directory = 0;
+			auto found_in = found_in_directory.find(file);
+			if (found_in != found_in_directory.end()) { next_directory = found_in->second + 1; }
+			else {
+				for (size_t i = 0; i < include_directories.size(); i++) {
+					if (include_directories[i] == file_directory) { next_directory = i + 1; break; }
+				}
+			}
+
+			for (const inner_include_directive &include : includes) {
+				if (!include.is_next && !include.angled) {
+					const path_id_t resolved = lookup(file_directory, include.name);
+					if (resolved != path_table::ROOT) {
+						resolved_includes.push_back(resolved);
+						continue;
+					}
+				}
+				for (size_t i = include.is_next ? next_directory : 0; i < include_directories.size(); i++) {
+					const path_id_t resolved = lookup(include_directories[i], include.name);
+					if (resolved != path_table::ROOT) {
+						resolved_includes.push_back(resolved);
+						found_in_directory.emplace(resolved, i);
+						break;
+					}
+				}
+			}
+
+			return resolved_includes;
+		}
+
+	public:
+		include_scanner() noexcept = default;
+
+		include_scanner(const include_scanner&) = delete;
+		include_scanner& operator=(const include_scanner&) = delete;
+
+		// NOTE: Same order as the -I flags on the command line.
+		void add_include_directory(const lime::string &directory) noexcept {
+			include_directories.push_back(table.intern(directory));
+		}
+
+		// NOTE: The table the IDs below come from. Can be used with a lime::stat_cache.
+		path_table& get_path_table() noexcept { return table; }
+
+		// NOTE: The source itself plus every header it transitively includes, each one exactly once.
+		std::vector<path_id_t> get_dependency_ids(path_id_t source) noexcept {
+			std::vector<path_id_t> result;
+
+			std::unordered_set<path_id_t> visited { source };
+			std::vector<path_id_t> stack { source };
+
+			while (!stack.empty()) {
+				const path_id_t file = stack.back();
+				stack.pop_back();
+				result.push_back(file);
+
+				for (const path_id_t include : scan(file)) {
+					if (visited.insert(include).second) { stack.push_back(include); }
+				}
+			}
+
+			return result;
+		}
+
+		// NOTE: Same as above, as absolute paths.
+		std::vector<lime::string> get_dependencies(const lime::string &source) noexcept {
+			std::vector<lime::string> result;
+			for (const path_id_t file : get_dependency_ids(table.intern(source))) { result.push_back(table.to_string(file)); }
+			return result;
+		}
+	};
+
+	// NOTE: Same as the other call_if_out_of_date, except that the dependencies are discovered by scanning the source.
+	template <typename functor_t>
+	bool call_if_out_of_date(const lime::string &path, const lime::string &source, include_scanner &scanner, functor_t functor, error_t &error) noexcept {
+		return call_if_out_of_date(path, scanner.get_dependencies(source), functor, error);
+	}
+
+	enum class copy_option_t : unsigned int {
+		NONE = 0,
+		PRESERVE_MODE = 1 << 0,
+		PRESERVE_TIMESTAMPS = 1 << 1,
+		// NOTE: Only makes sense together with PRESERVE_TIMESTAMPS, otherwise the mtimes never match.
+		SKIP_IF_SAME_SIZE_AND_MTIME = 1 << 2,
+		SKIP_IF_SAME_CONTENT = 1 << 3,
+		// NOTE: Hardlinks the destination to the source instead of copying, no bytes move at all.
+		// The destination shares the source's inode then, including its mode and timestamps, so if a different mode is asked for,
+		// or the two are on different filesystems, or the filesystem can't do hardlinks, it's a normal copy after all.
+		// Only for files that get replaced instead of edited in place afterwards, an in-place edit shows up on both sides.
+		HARDLINK = 1 << 4,
+	};
+
+	constexpr copy_option_t operator|(copy_option_t left, copy_option_t right) noexcept { return (copy_option_t)((unsigned int)left | (unsigned int)right); }
+	constexpr bool operator&(copy_option_t left, copy_option_t right) noexcept { return ((unsigned int)left & (unsigned int)right) != 0; }
+
+	// NOTE: Moves the bytes over with the cheapest thing the filesystem supports.
+	// A reflink shares the extents and copies nothing at all, copy_file_range stays in the kernel
+	// (and can do server-side copies on network filesystems), sendfile also stays in the kernel, but works in more places.
+	// Plain read and write is only the last resort.
+	inline bool inner_copy_file_contents(int source_fd, int destination_fd, off_t size) noexcept {
+		if (ioctl(destination_fd, FICLONE, source_fd) == 0) { return true; }
+
+		off_t copied = 0;
+		while (copied < size) {
+			ssize_t result = copy_file_range(source_fd, nullptr, destination_fd, nullptr, size - copied, 0);
+			if (result < 0 && errno == EINTR) { continue; }
+			if (result <= 0) { break; }
+			copied += result;
+		}
+		if (copied == size) { return true; }
+
+		off_t source_offset = copied;
+		while (copied < size) {
+			ssize_t result = sendfile(destination_fd, source_fd, &source_offset, size - copied);
+			if (result < 0 && errno == EINTR) { continue; }
+			if (result <= 0) { break; }
+			copied += result;
+		}
+		if (copied == size) { return true; }
+
+		if (lseek(source_fd, copied, SEEK_SET) < 0 || lseek(destination_fd, copied, SEEK_SET) < 0) { return false; }
+		char buffer[65536];
+		while (copied < size) {
+			ssize_t bytes_read = read(source_fd, buffer, sizeof(buffer));
+			if (bytes_read < 0 && errno == EINTR) { continue; }
+			if (bytes_read <= 0) { return false; }
+			if (!inner_write_all(destination_fd, buffer, bytes_read)) { return false; }
+			copied += bytes_read;
+		}
+		return true;
+	}
+
+	inline bool inner_files_have_same_content(const char *first_path, const char *second_path) noexcept {
+		inner_mapped_file first, second;
+		if (!first.open(first_path) || !second.open(second_path)) { return false; }
+		if (first.size() != second.size()) { return false; }
+		return first.size() == 0 || std::memcmp(first.data(), second.data(), first.size()) == 0;
+	}
+
+	// NOTE: The copy is written next to the destination and then renamed over it, so nobody ever sees half a file.
+	// mode is only used if it isn't -1 and PRESERVE_MODE isn't given.
+	// Returns false if the copy was skipped because the destination already matched.
+	inline bool inner_copy(const lime::string &source, const lime::string &destination, copy_option_t options, mode_t mode, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		int source_fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+		if (source_fd < 0) { error = error_t::ERRNO; return false; }
+
+		struct stat source_stat;
+		if (inner_fstat(source_fd, &source_stat) < 0) { close(source_fd); error = error_t::ERRNO; return false; }
+
+		// NOTE: -1 if any mode is fine.
+		const mode_t wanted_mode = (options & copy_option_t::PRESERVE_MODE) ? source_stat.st_mode & 07777 : mode;
+		const bool can_link = (options & copy_option_t::HARDLINK) && (wanted_mode == (mode_t)-1 || wanted_mode == (source_stat.st_mode & 07777));
+
+		struct stat destination_stat;
+		if (inner_stat(destination.c_str(), &destination_stat) == 0) {
+			const bool same_inode = destination_stat.st_dev == source_stat.st_dev && destination_stat.st_ino == source_stat.st_ino;
+			if (can_link && same_inode) {
+				close(source_fd);
+				return false;
+			}
+
+			const bool same_content = destination_stat.st_size == source_stat.st_size
+				&& (((options & copy_option_t::SKIP_IF_SAME_SIZE_AND_MTIME) && destination_stat.st_mtim.tv_sec == source_stat.st_mtim.tv_sec
+				     && destination_stat.st_mtim.tv_nsec == source_stat.st_mtim.tv_nsec)
+				    || ((options & copy_option_t::SKIP_IF_SAME_CONTENT) && inner_files_have_same_content(source.c_str(), destination.c_str())));
+			if (same_content && (wanted_mode == (mode_t)-1 || (destination_stat.st_mode & 07777) == wanted_mode)) {
+				close(source_fd);
+				return false;
+			}
+			// NOTE: Only the mode is off, no need to copy anything for that. Unless the destination is a hardlink to the source,
+			// then the chmod would change the source too, and the copy below replaces the link with a file of its own.
+			if (same_content && !same_inode) {
+				close(source_fd);
+				if (chmod(destination.c_str(), wanted_mode) < 0) { error = error_t::ERRNO; return false; }
+				return true;
+			}
+		}
+
+		const std::string temporary_path = destination.to_std_string() + ".lime_tmp." + std::to_string(getpid());
+
+		if (can_link) {
+			if (link(source.c_str(), temporary_path.c_str()) == 0) {
+				close(source_fd);
+				if (rename(temporary_path.c_str(), destination.c_str()) == 0) { return true; }
+				const int failure_errno = errno;
+				unlink(temporary_path.c_str());
+				errno = failure_errno;
+				error = error_t::ERRNO;
+				return false;
+			}
+			if (errno != EXDEV && errno != EPERM && errno != EMLINK && errno != EOPNOTSUPP) { close(source_fd); error = error_t::ERRNO; return false; }
+		}
+
+		int destination_fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if (destination_fd < 0) { close(source_fd); error = error_t::ERRNO; return false; }
+
+		bool success = inner_copy_file_contents(source_fd, destination_fd, source_stat.st_size);
+		if (success && (options & copy_option_t::PRESERVE_MODE)) { success = fchmod(destination_fd, source_stat.st_mode & 07777) == 0; }
+		else if (success && mode != (mode_t)-1) { success = fchmod(destination_fd, mode) == 0; }
+		if (success && (options & copy_option_t::PRESERVE_TIMESTAMPS)) {
+			const timespec times[2] = { source_stat.st_atim, source_stat.st_mtim };
+			success = futimens(destination_fd, times) == 0;
+		}
+
+		const int saved_errno = errno;
+		close(source_fd);
+		success &= close(destination_fd) == 0;
+		if (success) { success = rename(temporary_path.c_str(), destination.c_str()) == 0; }
+		else { errno = saved_errno; }
+
+		if (!success) {
+			const int failure_errno = errno;
+			unlink(temporary_path.c_str());
+			errno = failure_errno;
+			error = error_t::ERRNO;
+			return false;
+		}
+
+		return true;
+	}
+
+	inline bool copy(const lime::string &source, const lime::string &destination, copy_option_t options, error_t &error) noexcept {
+		return inner_copy(source, destination, options, (mode_t)-1, error);
+	}
+
+	// NOTE: Returns false if the copy was skipped because the destination already matched.
+	inline bool copy(const lime::string &source, const lime::string &destination, copy_option_t options = copy_option_t::NONE) noexcept {
+		error_t error;
+		bool result = copy(source, destination, options, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::ERRNO:
+			lime::error("lime::copy() failed to copy \"" + source + "\" to \"" + destination + "\", " + std::strerror(errno));
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::copy() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+
+		return result;
+	}
+
+	// NOTE: Like install(1): the parent directories are created, the destination gets the given mode,
+	// and the source's timestamps are kept, which also means that installing an unchanged file
+	// is only two stats. Staging thousands of headers into a prefix is I/O-bound this way, not spawn-bound.
+	// options are added to the ones above, copy_option_t::HARDLINK for example.
+	inline bool install(const lime::string &source, const lime::string &destination, mode_t mode, copy_option_t options, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		if (!inner_make_parent_directories(destination.to_std_string())) { error = error_t::ERRNO; return false; }
+
+		return inner_copy(source, destination, options | copy_option_t::PRESERVE_TIMESTAMPS | copy_option_t::SKIP_IF_SAME_SIZE_AND_MTIME, mode, error);
+	}
+
+	inline bool install(const lime::string &source, const lime::string &destination, mode_t mode, error_t &error) noexcept {
+		return install(source, destination, mode, copy_option_t::NONE, error);
+	}
+
+	inline bool install(const lime::string &source, const lime::string &destination, mode_t mode = 0644, copy_option_t options = copy_option_t::NONE) noexcept {
+		error_t error;
+		bool result = install(source, destination, mode, options, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::ERRNO:
+			lime::error("lime::install() failed to install \"" + source + "\" to \"" + destination + "\", " + std::strerror(errno));
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::install() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+
+		return result;
+	}
+
+	// NOTE: A rename if both are on the same filesystem, otherwise a copy that keeps mode and timestamps, and an unlink.
+	inline void move(const lime::string &source, const lime::string &destination, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		if (rename(source.c_str(), destination.c_str()) == 0) { return; }
+		if (errno != EXDEV) { error = error_t::ERRNO; return; }
+
+		inner_copy(source, destination, copy_option_t::PRESERVE_MODE | copy_option_t::PRESERVE_TIMESTAMPS, (mode_t)-1, error);
+		if (error != error_t::SUCCESS) { return; }
+		if (unlink(source.c_str()) < 0) { error = error_t::ERRNO; return; }
+	}
+
+	inline void move(const lime::string &source, const lime::string &destination) noexcept {
+		error_t error;
+		move(source, destination, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::ERRNO:
+			lime::error("lime::move() failed to move \"" + source + "\" to \"" + destination + "\", " + std::strerror(errno));
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::move() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+	}
+
+	// NOTE: Remembers the stat results of interned paths, indexed directly by path ID.
+	// A path that gets asked about a thousand times during one run gets stat-ed once.
+	class stat_cache {
+		struct entry_t {
+			enum : uint8_t { UNKNOWN, MISSING, PRESENT } state = UNKNOWN;
+			timespec mtime;
+		};
+
+		const path_table &table;
+		std::vector<entry_t> entries;
+
+	public:
+		stat_cache(const path_table &table) noexcept : table(table) { }
+
+		// NOTE: Returns false if the file doesn't exist.
+		bool get_last_modification_time(path_id_t id, timespec &mtime) noexcept {
+			if (id >= entries.size()) { entries.resize(table.size()); }
+
+			entry_t &entry = entries[id];
+			if (entry.state == entry_t::UNKNOWN) {
+				struct stat stat_buf;
+				if (inner_stat(table.to_string(id).c_str(), &stat_buf) == 0) {
+					entry.state = entry_t::PRESENT;
+					entry.mtime = stat_buf.st_mtim;
+				} else { entry.state = entry_t::MISSING; }
+			}
+
+			mtime = entry.mtime;
+			return entry.state == entry_t::PRESENT;
+		}
+
+		// NOTE: Has to be called for files that change during the run, outputs of build steps for example.
+		void invalidate(path_id_t id) noexcept {
+			if (id < entries.size()) { entries[id].state = entry_t::UNKNOWN; }
+		}
+	};
+
+	inline bool inner_timespec_less(const timespec &left, const timespec &right) noexcept {
+		return left.tv_sec < right.tv_sec || (left.tv_sec == right.tv_sec && left.tv_nsec < right.tv_nsec);
+	}
+
+	// NOTE: Same as the other call_if_out_of_date, except on path IDs and through a stat cache.
+	// A missing output always counts as out-of-date. Missing dependencies are an error.
+	template <typename functor_t>
+	bool call_if_out_of_date(stat_cache &cache, const path_table &table, path_id_t path, const std::vector<path_id_t> &deps, functor_t functor, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		timespec path_time;
+		bool out_of_date = !cache.get_last_modification_time(path, path_time);
+
+		for (size_t i = 0; i < deps.size() && !out_of_date; i++) {
+			timespec dep_time;
+			if (!cache.get_last_modification_time(deps[i], dep_time)) { error = error_t::ERRNO; errno = ENOENT; return false; }
+			out_of_date = inner_timespec_less(path_time, dep_time);
+		}
+
+		if (!out_of_date) { return false; }
+
+		const lime::string path_string = table.to_string(path);
+		lime::info('\"' + path_string + '\"' + " is out-of-date, calling remedial function...");
+		functor();
+		cache.invalidate(path);
+		lime::info('\"' + path_string + '\"' + " remedied");
+		return true;
+	}
+
+	// NOTE: Same as above, except that the dependencies are discovered by scanning the source.
+	// The cache has to be on the scanner's path table, path and source are IDs from it.
+	template <typename functor_t>
+	bool call_if_out_of_date(stat_cache &cache, include_scanner &scanner, path_id_t path, path_id_t source, functor_t functor, error_t &error) noexcept {
+		return call_if_out_of_date(cache, scanner.get_path_table(), path, scanner.get_dependency_ids(source), functor, error);
+	}
+
+	// NOTE: Persistent cache of directory listings, kept in the build directory.
+	// Every listing is stored together with the directory's device, inode and mtime. Adding, removing or renaming
+	// an entry always bumps the directory's mtime, so a directory whose stat hasn't changed since the last run
+	// is served from the cache without ever being opened. Source discovery for a no-op build is one stat per directory.
+	// Changing a file's contents doesn't touch the directory, but that doesn't matter here, only names and types are cached.
+	// This is for discovery that happens on every run, like finding the sources of a project. lime::directory_walker is
+	// for one-off walks: it streams entries and has fds for openat, but it reads every directory, every time.
+	class listing_cache {
+		static constexpr const char *CACHE_FILENAME = ".lime_listing_cache";
+
+	public:
+		struct entry_t {
+			std::string name;
+			unsigned char type;		// NOTE: DT_REG, DT_DIR, DT_LNK and so on, like in dirent.
+		};
+
+	private:
+		struct directory_t {
+			unsigned long long device;
+			unsigned long long inode;
+			long long mtime_seconds;
+			long long mtime_nanoseconds;
+			std::vector<entry_t> entries;
+		};
+
+		std::string cache_path;
+		std::unordered_map<std::string, directory_t> directories;
+		bool dirty = false;
+
+		void load() noexcept {
+			std::string content;
+			if (!inner_read_file(cache_path.c_str(), content)) { return; }
+
+			directory_t *current_directory = nullptr;
+			inner_for_each_line(content, [&](const std::string &line) {
+				if (line.size() > 2 && line[0] == 'D' && line[1] == ' ') {
+					directory_t directory { };
+					int path_offset = 0;
+					if (std::sscanf(line.c_str() + 2, "%llu %llu %lld %lld %n", &directory.device, &directory.inode,
+							&directory.mtime_seconds, &directory.mtime_nanoseconds, &path_offset) != 4 || path_offset == 0) {
+						current_directory = nullptr;
+						return;
+					}
+					current_directory = &(directories[line.substr(2 + path_offset)] = std::move(directory));
+				}
+				else if (line.size() > 2 && line[1] == ' ' && current_directory != nullptr) {
+					current_directory->entries.push_back({ line.substr(2), (unsigned char)(line[0] - '0') });
+				}
+			});
+		}
+
+		// NOTE: One "D <device> <inode> <mtime s> <mtime ns> <path>" line per directory, followed by one
+		// "<'0' + d_type> <name>" line per entry. Uncacheable directories (inode 0) are left out, they'd be re-read anyway,
+		// and a newline in one of their names would otherwise split a record and could fake a whole directory.
+		std::string serialize() const noexcept {
+			std::string result;
+			for (const std::pair<const std::string, directory_t> &directory : directories) {
+				if (directory.second.inode == 0) { continue; }
+				result += "D " + std::to_string(directory.second.device) + ' ' + std::to_string(directory.second.inode) + ' '
+					+ std::to_string(directory.second.mtime_seconds) + ' ' + std::to_string(directory.second.mtime_nanoseconds)
+					+ ' ' + directory.first + '\n';
+				for (const entry_t &entry : directory.second.entries) {
+					result += (char)('0' + entry.type);
+					result += ' ';
+					result += entry.name;
+					result += '\n';
+				}
+			}
+			return result;
+		}
+
+		bool read_directory(const std::string &path, std::vector<entry_t> &entries, bool &cacheable) noexcept {
+			entries.clear();
+
+			DIR *directory = opendir(path.c_str());
+			if (directory == nullptr) { return false; }
+
+			errno = 0;
+			while (dirent *entry = readdir(directory)) {
+				if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0) { continue; }
+
+				unsigned char type = entry->d_type;
+				if (type == DT_UNKNOWN) {
+					// NOTE: Some filesystems don't fill d_type in.
+					struct stat stat_buf;
+					inner_count(counter_t::STAT);
+					if (inner_fstatat(dirfd(directory), entry->d_name, &stat_buf, AT_SYMLINK_NOFOLLOW) == 0) {
+						type = S_ISDIR(stat_buf.st_mode) ? DT_DIR : S_ISLNK(stat_buf.st_mode) ? DT_LNK : S_ISREG(stat_buf.st_mode) ? DT_REG : DT_UNKNOWN;
+					}
+				}
+				if (std::strchr(entry->d_name, '\n') != nullptr) { cacheable = false; }
+
+				entries.push_back({ entry->d_name, type });
+			}
+
+			const bool success = errno == 0;
+			closedir(directory);
+			return success;
+		}
+
+	public:
+		listing_cache(const lime::string &build_directory) noexcept : cache_path(build_directory.to_std_string() + '/' + CACHE_FILENAME) { load(); }
+
+		listing_cache(const listing_cache&) = delete;
+		listing_cache& operator=(const listing_cache&) = delete;
+
+		~listing_cache() noexcept { save(); }
+
+		void save() noexcept {
+			if (!dirty) { return; }
+
+			if (!inner_atomic_write_file(cache_path, serialize())) {
+				lime::warn("lime::listing_cache failed to write \"" + cache_path + "\", directories will be re-read next run");
+				return;
+			}
+			dirty = false;
+		}
+
+		// NOTE: The entries of the directory, without "." and "..", in no particular order.
+		const std::vector<entry_t>& list(const lime::string &directory_path, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			static const std::vector<entry_t> no_entries;
+
+			const std::string path = inner_lexically_normalize(directory_path.to_std_string());
+
+			struct stat stat_buf;
+			if (inner_stat(path.c_str(), &stat_buf) < 0) { error = error_t::ERRNO; return no_entries; }
+
+			directory_t &directory = directories[path];
+			if (directory.device == (unsigned long long)stat_buf.st_dev && directory.inode == (unsigned long long)stat_buf.st_ino
+			    && directory.mtime_seconds == stat_buf.st_mtim.tv_sec && directory.mtime_nanoseconds == stat_buf.st_mtim.tv_nsec) {
+				return directory.entries;
+			}
+
+			bool cacheable = path.find('\n') == std::string::npos;
+			if (!read_directory(path, directory.entries, cacheable)) {
+				directories.erase(path);
+				error = error_t::ERRNO;
+				return no_entries;
+			}
+
+			// NOTE: If the directory changed within the last second, another change could come in with the same mtime
+			// on filesystems with coarse timestamps, and we'd never notice. Those get re-read next run.
+			if (stat_buf.st_mtim.tv_sec >= std::time(nullptr) - 1) { cacheable = false; }
+
+			directory.device = stat_buf.st_dev;
+			directory.inode = cacheable ? stat_buf.st_ino : 0;
+			directory.mtime_seconds = stat_buf.st_mtim.tv_sec;
+			directory.mtime_nanoseconds = stat_buf.st_mtim.tv_nsec;
+			dirty = true;
+			return directory.entries;
+		}
+
+		// NOTE: Same as lime::enum_files_recursive, except through the cache. Returns the absolute paths of all files
+		// under the directory whose names match the glob query. Hidden entries are only matched if the query starts
+		// with a dot, same as with glob. Every non-hidden directory gets descended into, whether it matches or not.
+		// Symlinks to directories aren't followed, they're matched against the query like any other entry,
+		// so a link cycle like "a -> ." can't send the walk around in circles.
+		std::vector<lime::string> enum_files_recursive(const lime::string &target_dir, const lime::string &query) noexcept {
+			std::vector<lime::string> result;
+
+			std::vector<std::string> stack { inner_lexically_normalize(target_dir.to_absolute().to_std_string()) };
+			while (!stack.empty()) {
+				const std::string directory = std::move(stack.back());
+				stack.pop_back();
+
+				error_t error;
+				const std::vector<entry_t> &entries = list(directory, error);
+				if (error != error_t::SUCCESS) {
+					lime::error("lime::listing_cache::enum_files_recursive() failed to list \"" + directory + '\"');
+					lime::exit_program(EXIT_FAILURE);
+				}
+
+				for (const entry_t &entry : entries) {
+					const std::string entry_path = directory == "/" ? '/' + entry.name : directory + '/' + entry.name;
+
+					if (entry.type == DT_DIR) {
+						if (entry.name[0] != '.' || query.c_str()[0] == '.') { stack.push_back(entry_path); }
+						continue;
+					}
+
+					if (fnmatch(query.c_str(), entry.name.c_str(), FNM_PERIOD) == 0) { result.push_back(entry_path); }
+				}
+			}
+
+			return result;
+		}
+	};
+
+	// NOTE: Coroutine-based build actions. A lime::task<T> is a lazily started coroutine, it runs once something
+	// co_awaits it and hands control back to whatever awaited it when it's done (symmetric transfer, so no stack growth).
+	// Everything runs on one thread, driven by an event_loop that waits on child exits (pidfd) and pipe readiness with epoll.
+	// Each in-flight build step costs one coroutine frame, a few hundred bytes, not a thread.
+	template <typename T = void>
+	class task;
+
+	struct inner_task_promise_base {
+		std::coroutine_handle<> continuation = std::noop_coroutine();
+
+		struct final_awaiter {
+			bool await_ready() const noexcept { return false; }
+
+			template <typename promise_t>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_t> handle) const noexcept { return handle.promise().continuation; }
+
+			void await_resume() const noexcept { }
+		};
+
+		std::suspend_always initial_suspend() const noexcept { return { }; }
+		final_awaiter final_suspend() const noexcept { return { }; }
+
+		// NOTE: Everything in lime is noexcept, exceptions in build actions are bugs in the build script.
+		void unhandled_exception() const noexcept { std::terminate(); }
+	};
+
+	template <typename T>
+	struct inner_task_promise : inner_task_promise_base {
+		std::optional<T> result;
+
+		task<T> get_return_object() noexcept;
+		void return_value(T value) noexcept { result.emplace(std::move(value)); }
+	};
+
+	template <>
+	struct inner_task_promise<void> : inner_task_promise_base {
+		task<void> get_return_object() noexcept;
+		void return_void() const noexcept { }
+	};
+
+	template <typename T>
+	class task {
+	public:
+		using promise_type = inner_task_promise<T>;
+
+	private:
+		std::coroutine_handle<promise_type> handle;
+
+	public:
+		explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) { }
+
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+
+		task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) { }
+		task& operator=(task &&other) noexcept {
+			if (handle) { handle.destroy(); }
+			handle = std::exchange(other.handle, nullptr);
+			return *this;
+		}
+
+		~task() noexcept {
+			if (handle) { handle.destroy(); }
+		}
+
+		bool is_done() const noexcept { return !handle || handle.done(); }
+		std::coroutine_handle<> get_handle() const noexcept { return handle; }
+
+		bool await_ready() const noexcept { return is_done(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			handle.promise().continuation = awaiting;
+			return handle;
+		}
+
+		T await_resume() noexcept {
+			if constexpr (!std::is_void_v<T>) { return std::move(*handle.promise().result); }
+		}
+	};
+
+	template <typename T>
+	task<T> inner_task_promise<T>::get_return_object() noexcept { return task<T>(std::coroutine_handle<inner_task_promise<T>>::from_promise(*this)); }
+
+	inline task<void> inner_task_promise<void>::get_return_object() noexcept { return task<void>(std::coroutine_handle<inner_task_promise<void>>::from_promise(*this)); }
+
+	// NOTE: Single-threaded event loop. Coroutines either sit in the ready queue or wait for an fd to become readable.
+	class event_loop {
+		// NOTE: How often child exit waiters get woken up anyway, in case SIGCHLD went to some other thread.
+		static constexpr int CHILD_EXIT_POLL_MILLISECONDS = 100;
+
+		int epoll_fd;
+		std::deque<std::coroutine_handle<>> ready;
+		std::unordered_map<int, std::coroutine_handle<>> waiting;
+
+		// NOTE: Only set up once something needs it, see wait_any_child_exit().
+		int child_signal_fd = -1;
+		sigset_t previous_signal_mask;
+		std::vector<std::coroutine_handle<>> child_exit_waiters;
+
+		void watch_child_exits(int operation) noexcept {
+			epoll_event event { };
+			event.events = EPOLLIN;
+			if (child_signal_fd != -1) {
+				event.data.fd = child_signal_fd;
+				epoll_ctl(epoll_fd, operation, child_signal_fd, &event);
+			}
+			if (inner_spawn_server_fd != -1) {
+				event.data.fd = inner_spawn_server_fd;
+				epoll_ctl(epoll_fd, operation, inner_spawn_server_fd, &event);
+			}
+		}
+
+		void wake_child_exit_waiters() noexcept {
+			signalfd_siginfo signal_info;
+			while (child_signal_fd != -1 && read(child_signal_fd, &signal_info, sizeof(signal_info)) > 0) { }
+
+			watch_child_exits(EPOLL_CTL_DEL);
+			for (std::coroutine_handle<> handle : child_exit_waiters) { schedule(handle); }
+			child_exit_waiters.clear();
+		}
+
+	public:
+		event_loop() noexcept : epoll_fd(epoll_create1(EPOLL_CLOEXEC)) {
+			if (epoll_fd < 0) {
+				lime::error("lime::event_loop() failed, epoll_create1 failed");
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+
+		event_loop(const event_loop&) = delete;
+		event_loop& operator=(const event_loop&) = delete;
+
+		~event_loop() noexcept {
+			close(epoll_fd);
+			if (child_signal_fd != -1) {
+				close(child_signal_fd);
+				pthread_sigmask(SIG_SETMASK, &previous_signal_mask, nullptr);
+			}
+		}
+
+		void schedule(std::coroutine_handle<> handle) noexcept { ready.push_back(handle); }
+
+		struct readable_awaiter {
+			event_loop &loop;
+			int fd;
+
+			bool await_ready() const noexcept { return false; }
+
+			void await_suspend(std::coroutine_handle<> handle) const noexcept {
+				epoll_event event { };
+				event.events = EPOLLIN;
+				event.data.fd = fd;
+				// NOTE: Regular files can't be waited on, but they're always readable anyway.
+				if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) { loop.schedule(handle); return; }
+				loop.waiting[fd] = handle;
+			}
+
+			void await_resume() const noexcept { }
+		};
+
+		// NOTE: Also wakes up on hang-up and errors, the caller finds out which one it was when it reads.
+		readable_awaiter wait_readable(int fd) noexcept { return { *this, fd }; }
+
+		// NOTE: For when there are no pidfds (kernels before 5.3). Blocks SIGCHLD in this thread and reads it through a signalfd
+		// until the loop is gone.
+		// Call it before checking whether the child is still running, otherwise an exit in between could go unnoticed.
+		void enable_child_exit_signals() noexcept {
+			if (child_signal_fd != -1) { return; }
+
+			sigset_t child_signal;
+			sigemptyset(&child_signal);
+			sigaddset(&child_signal, SIGCHLD);
+			pthread_sigmask(SIG_BLOCK, &child_signal, &previous_signal_mask);
+			child_signal_fd = signalfd(-1, &child_signal, SFD_CLOEXEC | SFD_NONBLOCK);
+			// NOTE: Without the signalfd, waiters still get woken up every CHILD_EXIT_POLL_MILLISECONDS.
+			if (child_signal_fd < 0) {
+				child_signal_fd = -1;
+				pthread_sigmask(SIG_SETMASK, &previous_signal_mask, nullptr);
+			}
+		}
+
+		struct child_exit_awaiter {
+			event_loop &loop;
+
+			bool await_ready() const noexcept { return false; }
+
+			void await_suspend(std::coroutine_handle<> handle) const noexcept {
+				if (loop.child_exit_waiters.empty()) { loop.watch_child_exits(EPOLL_CTL_ADD); }
+				loop.child_exit_waiters.push_back(handle);
+			}
+
+			void await_resume() const noexcept { }
+		};
+
+		// NOTE: Wakes up whenever some child might have exited: a SIGCHLD for our own children, a reply from the spawn server
+		// for its children, and every CHILD_EXIT_POLL_MILLISECONDS in any case. Whoever waits checks whether it was their child.
+		// Needs enable_child_exit_signals() first.
+		child_exit_awaiter wait_any_child_exit() noexcept { return { *this }; }
+
+		template <typename T>
+		T run(task<T> root) noexcept;
+	};
+
+	// NOTE: The loop that's currently running, so that awaitables can reach it without having it passed around everywhere.
+	inline event_loop *inner_current_event_loop = nullptr;
+
+	template <typename T>
+	T event_loop::run(task<T> root) noexcept {
+		event_loop *previous_event_loop = std::exchange(inner_current_event_loop, this);
+
+		schedule(root.get_handle());
+
+		epoll_event events[64];
+		while (true) {
+			while (!ready.empty()) {
+				std::coroutine_handle<> handle = ready.front();
+				ready.pop_front();
+				handle.resume();
+			}
+			if (root.is_done()) { break; }
+
+			if (waiting.empty() && child_exit_waiters.empty()) {
+				lime::bug("lime::event_loop::run() failed, root task is stuck without anything to wait for");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			int event_count;
+			{
+				inner_wait_timer wait_timer;
+				event_count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(*events), child_exit_waiters.empty() ? -1 : CHILD_EXIT_POLL_MILLISECONDS);
+			}
+			if (event_count < 0) {
+				if (errno == EINTR) { continue; }
+				lime::bug("lime::event_loop::run() failed, epoll_wait failed");
+				lime::exit_program(EXIT_FAILURE);
+			}
+			if (event_count == 0 && !child_exit_waiters.empty()) { wake_child_exit_waiters(); }
+
+			for (int i = 0; i < event_count; i++) {
+				if (!child_exit_waiters.empty() && events[i].data.fd != -1 && (events[i].data.fd == child_signal_fd || events[i].data.fd == inner_spawn_server_fd)) {
+					wake_child_exit_waiters();
+					continue;
+				}
+				auto waiter = waiting.find(events[i].data.fd);
+				if (waiter == waiting.end()) { continue; }
+				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, waiter->first, nullptr);
+				schedule(waiter->second);
+				waiting.erase(waiter);
+			}
+		}
+
+		inner_current_event_loop = previous_event_loop;
+		return root.await_resume();
+	}
+
+	// NOTE: Runs the task, and everything it starts, to completion on a fresh event loop. This is the bridge
+	// from normal code, main() for example, into coroutine land.
+	template <typename T>
+	T sync_wait(task<T> root) noexcept {
+		event_loop loop;
+		return loop.run(std::move(root));
+	}
+
+	inline event_loop& inner_get_current_event_loop() noexcept {
+		if (inner_current_event_loop == nullptr) {
+			lime::error("lime coroutine awaited outside of an event loop, start the root task with lime::sync_wait()");
+			lime::exit_program(EXIT_FAILURE);
+		}
+		return *inner_current_event_loop;
+	}
+
+	// NOTE: Starts the command and completes with its exit code once it exits. If it couldn't be started (or reaped),
+	// error is set and the result is -1, so a command that exits with 127 by itself isn't mistaken for a failed spawn.
+	// error has to stay alive until the task is done.
+	// If output isn't nullptr, the command's stdout and stderr get collected into it.
+	// Child exit is waited for through a pidfd, or through event_loop::wait_any_child_exit() if there are no pidfds.
+	// Reaping never blocks either: a spawn server child's exit code is only picked up once the server's reply is there,
+	// so nothing ever blocks the loop.
+	inline task<int> spawn_async(lime::string cmdline, error_t &error, std::string *output = nullptr) noexcept {
+		event_loop &loop = inner_get_current_event_loop();
+		error = error_t::SUCCESS;
+
+		int output_pipe[2] = { -1, -1 };
+		if (output != nullptr) {
+			if (pipe2(output_pipe, O_CLOEXEC) < 0) { error = error_t::ERRNO; co_return -1; }
+			inner_set_nonblocking(output_pipe[0]);
+		}
+
+		pid_t pid = inner_spawn_command(cmdline, output_pipe[1], nullptr, error);
+		if (output_pipe[1] != -1) { close(output_pipe[1]); }
+		if (error != error_t::SUCCESS) {
+			if (output_pipe[0] != -1) { close(output_pipe[0]); }
+			co_return -1;
+		}
+
+		if (output != nullptr) {
+			do { co_await loop.wait_readable(output_pipe[0]); } while (inner_receive_available(output_pipe[0], *output));
+			close(output_pipe[0]);
+		}
+
+		int exit_code = -1;
+		int pid_fd = inner_open_pidfd(pid);
+		if (pid_fd >= 0) {
+			co_await loop.wait_readable(pid_fd);
+			close(pid_fd);
+		}
+		else { loop.enable_child_exit_signals(); }
+		// NOTE: Once the pidfd fired, our own children get reaped on the first try, the spawn server's reply can still be on its way.
+		while (!inner_try_wait_for_command(pid, exit_code, error)) {
+			loop.enable_child_exit_signals();
+			co_await loop.wait_any_child_exit();
+		}
+		co_return error == error_t::SUCCESS ? exit_code : -1;
+	}
+
+	// NOTE: The coroutine version of lime::exec, same output, same behaviour on failure.
+	inline task<void> exec_async(lime::string cmdline) noexcept {
+		lime::cmd_label(cmdline);
+
+		error_t error;
+		int exit_code = co_await spawn_async(cmdline, error);
+		if (error != error_t::SUCCESS) {
+			lime::error("exec_async(cmdline) failed because of unsuccessful invocation");
+			lime::exit_program(EXIT_FAILURE);
+		}
+		if (exit_code != EXIT_SUCCESS) {
+			lime::error("exec_async(cmdline) failed, invoked command failed");
+			lime::exit_program(EXIT_FAILURE);
+		}
+	}
+
+	// NOTE: Starts eagerly and destroys itself when it's done, nobody awaits it. Only used to run when_all's children.
+	struct inner_detached_task {
+		struct promise_type {
+			inner_detached_task get_return_object() const noexcept { return { }; }
+			std::suspend_never initial_suspend() const noexcept { return { }; }
+			std::suspend_never final_suspend() const noexcept { return { }; }
+			void return_void() const noexcept { }
+			void unhandled_exception() const noexcept { std::terminate(); }
+		};
+	};
+
+	struct inner_when_all_state {
+		size_t remaining;
+		std::coroutine_handle<> waiter;
+	};
+
+	// NOTE: Holds the state by reference, so co_await never works on a copy of it.
+	struct inner_when_all_awaiter {
+		inner_when_all_state &state;
+
+		bool await_ready() const noexcept { return state.remaining == 0; }
+		void await_suspend(std::coroutine_handle<> handle) const noexcept { state.waiter = handle; }
+		void await_resume() const noexcept { }
+	};
+
+	template <typename T>
+	inner_detached_task inner_when_all_runner(task<T> &child, T *result, inner_when_all_state &state) noexcept {
+		*result = co_await child;
+		if (--state.remaining == 0 && state.waiter) { inner_get_current_event_loop().schedule(state.waiter); }
+	}
+
+	inline inner_detached_task inner_when_all_runner(task<void> &child, inner_when_all_state &state) noexcept {
+		co_await child;
+		if (--state.remaining == 0 && state.waiter) { inner_get_current_event_loop().schedule(state.waiter); }
+	}
+
+	// NOTE: Runs all the tasks concurrently and completes once every one of them has, with the results in the same order.
+	// T has to be default-constructible.
+	template <typename T>
+	task<std::vector<T>> when_all(std::vector<task<T>> tasks) noexcept {
+		std::vector<T> results(tasks.size());
+		inner_when_all_state state { tasks.size(), nullptr };
+		for (size_t i = 0; i < tasks.size(); i++) { inner_when_all_runner(tasks[i], &results[i], state); }
+		co_await inner_when_all_awaiter { state };
+		co_return results;
+	}
+
+	inline task<void> when_all(std::vector<task<void>> tasks) noexcept {
+		inner_when_all_state state { tasks.size(), nullptr };
+		for (task<void> &child : tasks) { inner_when_all_runner(child, state); }
+		co_await inner_when_all_awaiter { state };
+	}
+
+	template <typename T, typename... rest_t>
+	auto when_all(task<T> first, rest_t... rest) noexcept {
+		std::vector<task<T>> tasks;
+		tasks.reserve(1 + sizeof...(rest));
+		tasks.push_back(std::move(first));
+		(tasks.push_back(std::move(rest)), ...);
+		return when_all(std::move(tasks));
+	}
+
+	// NOTE: One-shot event, any number of coroutines can wait for it with co_await event.wait().
+	// Once it's set, waiting completes right away.
+	class async_event {
+		bool is_set = false;
+		std::vector<std::coroutine_handle<>> waiters;
+
+	public:
+		async_event() noexcept = default;
+
+		async_event(const async_event&) = delete;
+		async_event& operator=(const async_event&) = delete;
+
+		struct wait_awaiter {
+			async_event &event;
+
+			bool await_ready() const noexcept { return event.is_set; }
+			void await_suspend(std::coroutine_handle<> handle) const noexcept { event.waiters.push_back(handle); }
+			void await_resume() const noexcept { }
+		};
+
+		wait_awaiter wait() noexcept { return { *this }; }
+
+		void set() noexcept {
+			is_set = true;
+			for (std::coroutine_handle<> waiter : waiters) { inner_get_current_event_loop().schedule(waiter); }
+			waiters.clear();
+		}
+	};
+
+	// NOTE: Limits how many coroutines are in some section at once, the number of running compiler processes for example.
+	// Slots are handed over in first-come first-served order.
+	class async_semaphore {
+		size_t available;
+		std::deque<std::coroutine_handle<>> waiters;
+
+	public:
+		async_semaphore(size_t count) noexcept : available(count) { }
+
+		async_semaphore(const async_semaphore&) = delete;
+		async_semaphore& operator=(const async_semaphore&) = delete;
+
+		struct acquire_awaiter {
+			async_semaphore &semaphore;
+
+			bool await_ready() const noexcept {
+				if (semaphore.available == 0) { return false; }
+				semaphore.available--;
+				return true;
+			}
+			void await_suspend(std::coroutine_handle<> handle) const noexcept { semaphore.waiters.push_back(handle); }
+			void await_resume() const noexcept { }
+		};
+
+		acquire_awaiter acquire() noexcept { return { *this }; }
+
+		void release() noexcept {
+			if (waiters.empty()) { available++; return; }
+			inner_get_current_event_loop().schedule(waiters.front());
+			waiters.pop_front();
+		}
+	};
+
+	struct inner_module_directives {
+		std::string provided;
+		std::vector<std::string> required;
+	};
+
+	// NOTE: Finds the module declaration and the imports of a C++20 source. Module directives always start a line
+	// (that's what makes them scannable without preprocessing, see P1857), so only line starts outside
+	// of comments and literals are looked at.
+	// "module foo;" (an implementation unit) implicitly imports foo. "import :part;" means the partition of our own module.
+	// Header units (import <vector>;) aren't supported and are left out.
+	inline void inner_scan_module_directives(const char *head, const char *end, inner_module_directives &result) noexcept {
+		const char *const begin = head;
+		std::string own_module;
+
+		auto skip_whitespace = [&end](const char *position) {
+			while (position < end && (*position == ' ' || *position == '\t')) { position++; }
+			return position;
+		};
+		auto skip_keyword = [&end, &skip_whitespace](const char *position, std::string_view keyword) -> const char* {
+			if ((size_t)(end - position) <= keyword.size() || std::string_view(position, keyword.size()) != keyword) { return nullptr; }
+			const char next = position[keyword.size()];
+			if (next != ' ' && next != '\t' && next != ';' && next != ':') { return nullptr; }
+			return skip_whitespace(position + keyword.size());
+		};
+		auto read_name = [&end](const char *&position) {
+			const char *name_start = position;
+			while (position < end && (std::isalnum((unsigned char)*position) || *position == '_' || *position == '.' || *position == ':')) { position++; }
+			return std::string(name_start, position);
+		};
+
+		auto parse_line = [&](const char *position) {
+			position = skip_whitespace(position);
+			bool exported = false;
+			if (const char *after_export = skip_keyword(position, "export")) {
+				exported = true;
+				position = after_export;
+			}
+
+			if (const char *after_module = skip_keyword(position, "module")) {
+				std::string name = read_name(after_module);
+				// NOTE: "module;" starts the global module fragment and "module :private;" the private one.
+				if (name.empty() || name[0] == ':') { return; }
+				own_module = name.substr(0, name.find(':'));
+				if (exported || name.find(':') != std::string::npos) { result.provided = name; }
+				else { result.required.push_back(name); }
+				return;
+			}
+
+			if (const char *after_import = skip_keyword(position, "import")) {
+				std::string name = read_name(after_import);
+				if (name.empty()) { return; }
+				if (name[0] == ':') { name = own_module + name; }
+				result.required.push_back(name);
+			}
+		};
+
+		parse_line(head);
+		while ((head = inner_find_any_of(head, end, '\n', '/', '\"', '\'')) < end) {
+			switch (*head) {
+			case '\n':
+				head++;
+				parse_line(head);
+				continue;
+
+			case '/':
+			case '\'':
+			case '\"':
+				head = inner_skip_comment_or_literal(head, begin, end);
+				if (head == nullptr) { return; }
+				continue;
+			}
+		}
+
+		std::sort(result.required.begin(), result.required.end());
+		result.required.erase(std::unique(result.required.begin(), result.required.end()), result.required.end());
+	}
+
+	// NOTE: Pulls the "logical-name"s out of the "provides" and "requires" arrays of a P1689 dependency file,
+	// which is what clang-scan-deps -format=p1689 and gcc -fdeps-format=p1689r5 write.
+	// Not a real JSON parser, but the format is simple and generated by compilers, so this is enough.
+	inline bool inner_parse_p1689(const std::string &json, inner_module_directives &result) noexcept {
+		auto collect_logical_names = [&json](const char *key, std::vector<std::string> &names) {
+			size_t array_start = json.find(std::string("\"") + key + '\"');
+			if (array_start == std::string::npos) { return true; }
+			array_start = json.find('[', array_start);
+			if (array_start == std::string::npos) { return false; }
+
+			size_t array_end = array_start;
+			for (int depth = 0; array_end < json.size(); array_end++) {
+				if (json[array_end] == '[') { depth++; }
+				else if (json[array_end] == ']' && --depth == 0) { break; }
+			}
+			if (array_end == json.size()) { return false; }
+
+			for (size_t position = json.find("\"logical-name\"", array_start); position < array_end; position = json.find("\"logical-name\"", position)) {
+				const size_t value_start = json.find('\"', json.find(':', position + 14));
+				const size_t value_end = json.find('\"', value_start + 1);
+				if (value_start == std::string::npos || value_end == std::string::npos) { return false; }
+				names.push_back(json.substr(value_start + 1, value_end - value_start - 1));
+				position = value_end + 1;
+			}
+			return true;
+		};
+
+		std::vector<std::string> provided_names;
+		if (!collect_logical_names("provides", provided_names) || provided_names.size() > 1) { return false; }
+		if (!provided_names.empty()) { result.provided = provided_names[0]; }
+		return collect_logical_names("requires", result.required);
+	}
+
+	// NOTE: What a module_graph's command builder gets to see about the translation unit it should build a command for.
+	struct module_unit {
+		lime::string source;
+		lime::string object_path;
+		lime::string provided_module;		// NOTE: Empty if the unit doesn't export a module.
+		lime::string bmi_path;			// NOTE: Where the BMI for provided_module goes, empty if there is none.
+		std::vector<lime::string> required_modules;
+	};
+
+	// NOTE: Builds C++20 module sources in the right order without giving up parallelism.
+	// Every source is scanned for its module declaration and imports (with the built-in scanner, or from the
+	// compiler's P1689 output), and a unit only starts compiling once the units providing everything it imports are done.
+	// Everything that doesn't depend on a pending BMI stays in flight, up to max_jobs compiles at once.
+	// BMIs go into bmi_directory, named like the compiler names them, and are reused across runs: a unit is only rebuilt if its object or BMI is missing,
+	// or older than its source, its headers (if an include_scanner was given) or any BMI it imports.
+	// Imports that no unit provides, like "import std;", are assumed to be taken care of by the compiler.
+	class module_graph {
+		struct unit_t {
+			module_unit description;
+			std::vector<size_t> providers;
+			bool failed = false;
+		};
+
+		std::string bmi_directory;
+		std::string bmi_extension;
+		include_scanner *scanner = nullptr;
+		std::vector<unit_t> units;
+
+		bool is_out_of_date(const unit_t &unit) noexcept {
+			timespec oldest_output { };
+			bool first_output = true;
+			for (const lime::string *output : { &unit.description.object_path, &unit.description.bmi_path }) {
+				if (output->length() == 0) { continue; }
+				struct stat stat_buf;
+				if (inner_stat(output->c_str(), &stat_buf) < 0) { return true; }
+				if (first_output || inner_timespec_less(stat_buf.st_mtim, oldest_output)) { oldest_output = stat_buf.st_mtim; }
+				first_output = false;
+			}
+
+			std::vector<lime::string> dependencies;
+			if (scanner != nullptr) { dependencies = scanner->get_dependencies(unit.description.source); }
+			else { dependencies.push_back(unit.description.source); }
+			for (size_t provider : unit.providers) { dependencies.push_back(units[provider].description.bmi_path); }
+
+			for (const lime::string &dependency : dependencies) {
+				struct stat stat_buf;
+				if (inner_stat(dependency.c_str(), &stat_buf) < 0 || inner_timespec_less(oldest_output, stat_buf.st_mtim)) { return true; }
+			}
+			return false;
+		}
+
+		void add_unit(const lime::string &source, const lime::string &object_path, inner_module_directives &&directives) noexcept {
+			unit_t unit;
+			unit.description.source = source;
+			unit.description.object_path = object_path;
+			unit.description.provided_module = directives.provided;
+			if (!directives.provided.empty()) {
+				std::string bmi_filename = directives.provided;
+				std::replace(bmi_filename.begin(), bmi_filename.end(), ':', '-');
+				unit.description.bmi_path = bmi_directory + '/' + bmi_filename + bmi_extension;
+			}
+			for (std::string &required_module : directives.required) { unit.description.required_modules.push_back(std::move(required_module)); }
+			units.push_back(std::move(unit));
+		}
+
+		// NOTE: Resolves imports to provider units and makes sure the graph can actually be built.
+		bool link_units(error_t &error) noexcept {
+			std::unordered_map<std::string, size_t> providers;
+			for (size_t i = 0; i < units.size(); i++) {
+				if (units[i].description.provided_module.length() == 0) { continue; }
+				if (!providers.emplace(units[i].description.provided_module.to_std_string(), i).second) {
+					lime::error("module \"" + units[i].description.provided_module + "\" is provided by more than one source");
+					error = error_t::MODULE_GRAPH_INVALID;
+					return false;
+				}
+			}
+
+			for (unit_t &unit : units) {
+				unit.providers.clear();
+				for (const lime::string &required_module : unit.description.required_modules) {
+					auto provider = providers.find(required_module.to_std_string());
+					if (provider != providers.end()) { unit.providers.push_back(provider->second); }
+				}
+			}
+
+			// NOTE: An import cycle would leave the units in it waiting for each other forever.
+			enum : uint8_t { UNVISITED, IN_PROGRESS, DONE };
+			std::vector<uint8_t> states(units.size(), UNVISITED);
+			std::vector<std::pair<size_t, size_t>> stack;
+			for (size_t root = 0; root < units.size(); root++) {
+				if (states[root] != UNVISITED) { continue; }
+				stack.emplace_back(root, 0);
+				states[root] = IN_PROGRESS;
+				while (!stack.empty()) {
+					std::pair<size_t, size_t> &frame = stack.back();
+					if (frame.second == units[frame.first].providers.size()) {
+						states[frame.first] = DONE;
+						stack.pop_back();
+						continue;
+					}
+					const size_t provider = units[frame.first].providers[frame.second++];
+					if (states[provider] == IN_PROGRESS) {
+						lime::error("module import cycle involving \"" + units[provider].description.source + '\"');
+						error = error_t::MODULE_GRAPH_INVALID;
+						return false;
+					}
+					if (states[provider] == UNVISITED) {
+						states[provider] = IN_PROGRESS;
+						stack.emplace_back(provider, 0);
+					}
+				}
+			}
+
+			return true;
+		}
+
+		template <typename functor_t>
+		task<void> build_unit(size_t index, std::vector<async_event> &finished, async_semaphore &job_slots, functor_t &get_compile_command) noexcept {
+			unit_t &unit = units[index];
+
+			for (size_t provider : unit.providers) {
+				co_await finished[provider].wait();
+				if (units[provider].failed) { unit.failed = true; }
+			}
+
+			if (!unit.failed && is_out_of_date(unit)) {
+				if (unit.description.bmi_path.length() != 0) { inner_make_parent_directories(unit.description.bmi_path.to_std_string()); }
+				inner_make_parent_directories(unit.description.object_path.to_std_string());
+
+				const lime::string cmdline = get_compile_command((const module_unit&)unit.description);
+
+				co_await job_slots.acquire();
+				lime::cmd_label(cmdline);
+				error_t error;
+				const int exit_code = co_await spawn_async(cmdline, error);
+				job_slots.release();
+
+				if (error != error_t::SUCCESS || exit_code != EXIT_SUCCESS) {
+					lime::error("compiling \"" + unit.description.source + "\" failed");
+					unit.failed = true;
+				}
+			}
+
+			finished[index].set();
+		}
+
+		template <typename functor_t>
+		task<void> build_all(size_t max_jobs, functor_t get_compile_command) noexcept {
+			std::vector<async_event> finished(units.size());
+			async_semaphore job_slots(max_jobs == 0 ? 1 : max_jobs);
+
+			std::vector<task<void>> unit_tasks;
+			unit_tasks.reserve(units.size());
+			for (size_t i = 0; i < units.size(); i++) { unit_tasks.push_back(build_unit(i, finished, job_slots, get_compile_command)); }
+			co_await when_all(std::move(unit_tasks));
+		}
+
+	public:
+		module_graph(const toolchain &compiler, const lime::string &bmi_directory) noexcept
+			: bmi_directory(bmi_directory.to_std_string()), bmi_extension(compiler.get_bmi_extension().to_std_string()) { }
+
+		// NOTE: Puts the BMIs where the compiler looks for them by itself, gcm.cache for gcc.
+		module_graph(const toolchain &compiler) noexcept : module_graph(compiler, compiler.get_default_bmi_directory()) { }
+
+		// NOTE: Makes the headers of every unit count towards its staleness too.
+		void set_include_scanner(include_scanner &new_scanner) noexcept { scanner = &new_scanner; }
+
+		// NOTE: Scans the source with the built-in scanner.
+		void add_source(const lime::string &source, const lime::string &object_path, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			inner_mapped_file mapped_file;
+			if (!mapped_file.open(source.c_str())) { error = error_t::ERRNO; return; }
+
+			inner_module_directives directives;
+			inner_scan_module_directives(mapped_file.data(), mapped_file.data() + mapped_file.size(), directives);
+			add_unit(source, object_path, std::move(directives));
+		}
+
+		void add_source(const lime::string &source, const lime::string &object_path) noexcept {
+			error_t error;
+			add_source(source, object_path, error);
+			if (error != error_t::SUCCESS) {
+				lime::error("lime::module_graph::add_source() failed to read \"" + source + '\"');
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+
+		// NOTE: Takes the module information from a P1689 file the compiler wrote for the source instead of scanning it.
+		void add_source_from_p1689(const lime::string &source, const lime::string &object_path, const lime::string &p1689_path, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			std::string json;
+			if (!inner_read_file(p1689_path.c_str(), json)) { error = error_t::ERRNO; return; }
+
+			inner_module_directives directives;
+			if (!inner_parse_p1689(json, directives)) { error = error_t::PROTOCOL_INVALID; return; }
+			add_unit(source, object_path, std::move(directives));
+		}
+
+		void add_source_from_p1689(const lime::string &source, const lime::string &object_path, const lime::string &p1689_path) noexcept {
+			error_t error;
+			add_source_from_p1689(source, object_path, p1689_path, error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::ERRNO:
+				lime::error("lime::module_graph::add_source_from_p1689() failed to read \"" + p1689_path + '\"');
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::PROTOCOL_INVALID:
+				lime::error("lime::module_graph::add_source_from_p1689() failed, \"" + p1689_path + "\" isn't valid P1689");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::module_graph::add_source_from_p1689() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+
+		// NOTE: get_compile_command(const module_unit&) returns the command that compiles the unit to its object
+		// (and its BMI, if it provides a module). It only gets called for units that are out-of-date.
+		template <typename functor_t>
+		void build(size_t max_jobs, functor_t get_compile_command, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			if (!link_units(error)) { return; }
+
+			sync_wait(build_all(max_jobs, std::move(get_compile_command)));
+
+			for (const unit_t &unit : units) {
+				if (unit.failed) { error = error_t::CMD_RETURNED_FAILURE; }
+			}
+		}
+
+		template <typename functor_t>
+		void build(size_t max_jobs, functor_t get_compile_command) noexcept {
+			error_t error;
+			build(max_jobs, std::move(get_compile_command), error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::MODULE_GRAPH_INVALID:
+				lime::error("lime::module_graph::build() failed, module graph is invalid");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_RETURNED_FAILURE:
+				lime::error("lime::module_graph::build() failed, one or more units failed to compile");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::module_graph::build() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+		}
+	};
+
+	// NOTE: Fast non-cryptographic 64-bit hash, 8 bytes at a time. Only used to notice whether a file changed,
+	// not for anything that has to hold up against somebody trying to cause collisions.
+	inline uint64_t inner_hash_bytes(const char *data, size_t size, uint64_t seed = 0) noexcept {
+		constexpr uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+
+		auto mix = [](uint64_t value) {
+			value ^= value >> 33;
+			value *= 0xff51afd7ed558ccdull;
+			value ^= value >> 33;
+			value *= 0xc4ceb9fe1a85ec53ull;
+			value ^= value >> 33;
+			return value;
+		};
+
+		uint64_t hash = seed ^ (size * multiplier);
+		const char *const end = data + (size & ~(size_t)7);
+		for (; data < end; data += 8) {
+			uint64_t word;
+			std::memcpy(&word, data, sizeof(word));
+			hash = (hash ^ mix(word)) * multiplier;
+		}
+
+		uint64_t tail = 0;
+		std::memcpy(&tail, data, size & 7);
+		hash = (hash ^ mix(tail)) * multiplier;
+
+		return mix(hash);
+	}
+
+	inline bool inner_hash_file(const char *path, uint64_t &hash) noexcept {
+		inner_mapped_file mapped_file;
+		if (!mapped_file.open(path)) { return false; }
+		hash = inner_hash_bytes(mapped_file.data(), mapped_file.size());
+		return true;
+	}
+
+	// NOTE: Early cutoff. After a step reruns, its output gets hashed, and if the hash is the same as last time,
+	// the output keeps its old "effective" modification time. Dependents compare against the effective time
+	// instead of the real mtime, so a comment-only edit recompiles one object and stops there,
+	// instead of relinking everything downstream.
+	// Files that aren't in the database, or that changed behind its back (their size or mtime doesn't match
+	// what was recorded), just use their real mtime.
+	class cutoff_db {
+		static constexpr const char *DATABASE_FILENAME = ".lime_cutoff_db";
+
+		struct entry_t {
+			uint64_t hash;
+			long long size;
+			timespec mtime;
+			timespec effective_time;
+		};
+
+		std::string database_path;
+		std::unordered_map<std::string, entry_t> entries;
+		bool dirty = false;
+
+		void load() noexcept {
+			std::string content;
+			if (!inner_read_file(database_path.c_str(), content)) { return; }
+
+			inner_for_each_line(content, [this](const std::string &line) {
+				entry_t entry;
+				long long mtime_seconds, mtime_nanoseconds, effective_seconds, effective_nanoseconds;
+				int path_offset = 0;
+				if (std::sscanf(line.c_str(), "%llx %lld %lld %lld %lld %lld %n", (unsigned long long*)&entry.hash, &entry.size,
+						&mtime_seconds, &mtime_nanoseconds, &effective_seconds, &effective_nanoseconds, &path_offset) != 6 || path_offset == 0) { return; }
+				entry.mtime = { (time_t)mtime_seconds, (long)mtime_nanoseconds };
+				entry.effective_time = { (time_t)effective_seconds, (long)effective_nanoseconds };
+				entries[line.substr(path_offset)] = entry;
+			});
+		}
+
+		static std::string key_for(const lime::string &path) noexcept { return inner_lexically_normalize(path.to_std_string()); }
+
+	public:
+		cutoff_db(const lime::string &build_directory) noexcept : database_path(build_directory.to_std_string() + '/' + DATABASE_FILENAME) { load(); }
+
+		cutoff_db(const cutoff_db&) = delete;
+		cutoff_db& operator=(const cutoff_db&) = delete;
+
+		~cutoff_db() noexcept { save(); }
+
+		void save() noexcept {
+			if (!dirty) { return; }
+
+			std::string content;
+			char line_start[128];
+			for (const std::pair<const std::string, entry_t> &entry : entries) {
+				std::snprintf(line_start, sizeof(line_start), "%llx %lld %lld %lld %lld %lld ", (unsigned long long)entry.second.hash, entry.second.size,
+						(long long)entry.second.mtime.tv_sec, (long long)entry.second.mtime.tv_nsec,
+						(long long)entry.second.effective_time.tv_sec, (long long)entry.second.effective_time.tv_nsec);
+				content += line_start;
+				content += entry.first;
+				content += '\n';
+			}
+
+			if (!inner_atomic_write_file(database_path, content)) {
+				lime::warn("lime::cutoff_db failed to write \"" + database_path + "\", next run won't be able to cut off early");
+				return;
+			}
+			dirty = false;
+		}
+
+		// NOTE: Returns false if the file doesn't exist.
+		bool get_effective_time(const lime::string &path, timespec &result) const noexcept {
+			struct stat stat_buf;
+			if (inner_stat(path.c_str(), &stat_buf) < 0) { return false; }
+
+			result = stat_buf.st_mtim;
+			auto entry = entries.find(key_for(path));
+			if (entry != entries.end() && entry->second.size == (long long)stat_buf.st_size
+			    && entry->second.mtime.tv_sec == stat_buf.st_mtim.tv_sec && entry->second.mtime.tv_nsec == stat_buf.st_mtim.tv_nsec) {
+				result = entry->second.effective_time;
+			}
+			return true;
+		}
+
+		// NOTE: Call after the step producing the output ran. Returns true if the output's content actually changed.
+		bool record_output(const lime::string &path, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			struct stat stat_buf;
+			uint64_t hash;
+			if (inner_stat(path.c_str(), &stat_buf) < 0 || !inner_hash_file(path.c_str(), hash)) { error = error_t::ERRNO; return true; }
+
+			entry_t &entry = entries[key_for(path)];
+			const bool changed = entry.size != (long long)stat_buf.st_size || entry.hash != hash || entry.effective_time.tv_sec == 0;
+
+			entry.hash = hash;
+			entry.size = stat_buf.st_size;
+			entry.mtime = stat_buf.st_mtim;
+			if (changed) { entry.effective_time = stat_buf.st_mtim; }
+			dirty = true;
+
+			return changed;
+		}
+	};
+
+	// NOTE: Same as the other call_if_out_of_date, but with early cutoff: dependencies are compared by their effective time,
+	// and the output gets recorded in the database after the functor ran. A missing output always counts as out-of-date.
+	template <typename functor_t>
+	bool call_if_out_of_date(const lime::string &path, const std::vector<lime::string> &deps, cutoff_db &database, functor_t functor, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		struct stat stat_buf;
+		bool out_of_date = inner_stat(path.c_str(), &stat_buf) < 0;
+
+		for (size_t i = 0; i < deps.size() && !out_of_date; i++) {
+			timespec dep_time;
+			if (!database.get_effective_time(deps[i], dep_time)) { error = error_t::ERRNO; return false; }
+			out_of_date = inner_timespec_less(stat_buf.st_mtim, dep_time);
+		}
+
+		if (!out_of_date) { return false; }
+
+		lime::info('\"' + path + '\"' + " is out-of-date, calling remedial function...");
+		functor();
+		const bool changed = database.record_output(path, error);
+		if (error != error_t::SUCCESS) { return true; }		// NOTE: The output wasn't produced (or can't be read), that's not remedied.
+		if (changed) { lime::info('\"' + path + '\"' + " remedied"); }
+		else { lime::info('\"' + path + '\"' + " remedied, unchanged, dependents stay up-to-date"); }
+		return true;
+	}
+
+	template <typename functor_t>
+	bool call_if_out_of_date(const lime::string &path, const lime::string &source, include_scanner &scanner, cutoff_db &database, functor_t functor, error_t &error) noexcept {
+		return call_if_out_of_date(path, scanner.get_dependencies(source), database, functor, error);
+	}
+
+	struct test_t {
+		lime::string name;			// NOTE: Has to be unique, results are remembered by name.
+		lime::string cmdline;
+		std::vector<lime::string> inputs;	// NOTE: Data files and such that the result depends on, besides the executable itself.
+	};
+
+	// NOTE: Remembers the last result of every test, how long it took and a fingerprint of its command line,
+	// executable and inputs, so that tests which passed and haven't changed since can be skipped,
+	// and so the slow ones can be started first next time.
+	class inner_test_results {
+		static constexpr const char *RESULTS_FILENAME = ".lime_test_results";
+
+	public:
+		struct record_t {
+			bool passed;
+			uint64_t duration_nanoseconds;
+			uint64_t fingerprint;
+		};
+
+	private:
+		std::string results_path;
+		std::unordered_map<std::string, record_t> records;
+
+	public:
+		inner_test_results(const lime::string &build_directory) noexcept : results_path(build_directory.to_std_string() + '/' + RESULTS_FILENAME) {
+			std::string content;
+			if (!inner_read_file(results_path.c_str(), content)) { return; }
+
+			inner_for_each_line(content, [this](const std::string &line) {
+				int passed;
+				unsigned long long duration_nanoseconds, fingerprint;
+				int name_offset = 0;
+				if (std::sscanf(line.c_str(), "%d %llu %llx %n", &passed, &duration_nanoseconds, &fingerprint, &name_offset) != 3 || name_offset == 0) { return; }
+				records[line.substr(name_offset)] = { passed != 0, duration_nanoseconds, fingerprint };
+			});
+		}
+
+		const record_t* find(const lime::string &name) const noexcept {
+			auto record = records.find(name.to_std_string());
+			return record == records.end() ? nullptr : &record->second;
+		}
+
+		void set(const lime::string &name, const record_t &record) noexcept { records[name.to_std_string()] = record; }
+
+		void save() noexcept {
+			std::string content;
+			char line_start[96];
+			for (const std::pair<const std::string, record_t> &record : records) {
+				std::snprintf(line_start, sizeof(line_start), "%d %llu %llx ", record.second.passed ? 1 : 0,
+						(unsigned long long)record.second.duration_nanoseconds, (unsigned long long)record.second.fingerprint);
+				content += line_start;
+				content += record.first;
+				content += '\n';
+			}
+
+			if (!inner_atomic_write_file(results_path, content)) {
+				lime::warn("lime::run_tests() failed to write \"" + results_path + "\", every test will run next time");
+			}
+		}
+	};
+
+	// NOTE: Combines the command line with the identity and mtime of the executable and every input.
+	// Returns 0 (never matches anything) if one of them doesn't exist.
+	inline uint64_t inner_test_fingerprint(const test_t &test) noexcept {
+		uint64_t result = inner_hash_bytes(test.cmdline.c_str(), test.cmdline.length());
+
+		auto add_file = [&result](const std::string &path) {
+			struct stat stat_buf;
+			if (inner_stat(path.c_str(), &stat_buf) < 0) { return false; }
+			const long long identity[5] = { (long long)stat_buf.st_dev, (long long)stat_buf.st_ino, (long long)stat_buf.st_size,
+							(long long)stat_buf.st_mtim.tv_sec, (long long)stat_buf.st_mtim.tv_nsec };
+			result = inner_hash_bytes((const char*)identity, sizeof(identity), result);
+			return true;
+		};
+
+		std::vector<std::string_view> args;
+		std::string unquote_buffer;
+		inner_tokenize_command_line(std::string_view(test.cmdline.c_str(), test.cmdline.length()), args, unquote_buffer);
+		if (args.empty()) { return 0; }
+		const std::string executable(args[0]);
+		if (!add_file(executable.find('/') == std::string::npos ? inner_find_executable(executable) : executable)) { return 0; }
+
+		for (const lime::string &input : test.inputs) {
+			if (!add_file(input.to_std_string())) { return 0; }
+		}
+
+		return result == 0 ? 1 : result;
+	}
+
+	struct inner_test_outcome {
+		bool started = false;
+		bool passed = false;
+		bool timed_out = false;
+		int exit_code = -1;
+		uint64_t duration_nanoseconds = 0;
+		std::string output;
+	};
+
+	inline void inner_report_test(const test_t &test, const inner_test_outcome &outcome, unsigned int timeout_seconds) noexcept {
+		char seconds[32];
+		std::snprintf(seconds, sizeof(seconds), "%.3f s", outcome.duration_nanoseconds / 1e9);
+
+		if (outcome.passed) {
+			lime::info("test \"" + test.name + "\" passed in " + seconds);
+			return;
+		}
+
+		if (!outcome.started) { lime::error("test \"" + test.name + "\" couldn't be started"); }
+		else if (outcome.timed_out) { lime::error("test \"" + test.name + "\" timed out after " + lime::string(std::to_string(timeout_seconds)) + " s"); }
+		else { lime::error("test \"" + test.name + "\" failed with exit code " + lime::string(std::to_string(outcome.exit_code)) + " after " + seconds); }
+
+		if (outcome.output.empty()) { return; }
+		fflush(stdout);
+		inner_write_all(STDOUT_FILENO, outcome.output.data(), outcome.output.size());
+		if (outcome.output.back() != '\n') { inner_write_all(STDOUT_FILENO, "\n", 1); }
+	}
+
+	// NOTE: Runs one test in a job slot. The child's output, its exit (pidfd) and the timeout (timerfd) all go into
+	// one epoll set, and the event loop waits on that, so a test costs a coroutine frame and a handful of fds.
+	// Once the child has exited, whatever's left in the pipe is collected and that's it. Grandchildren
+	// that are still holding the pipe open don't keep the test going.
+	// Without pidfds, the child's exit is first noticed when its output hits EOF, and it's reaped through
+	// event_loop::wait_any_child_exit() after that, so a test that closes its stdout and keeps running doesn't block anybody.
+	// The test leads its own process group, a timeout kills the whole group, grandchildren included.
+	inline task<void> inner_run_test(const test_t &test, unsigned int timeout_seconds, async_semaphore &job_slots, inner_test_outcome &outcome) noexcept {
+		event_loop &loop = inner_get_current_event_loop();
+
+		co_await job_slots.acquire();
+
+		int output_pipe[2];
+		if (pipe2(output_pipe, O_CLOEXEC) < 0) {
+			job_slots.release();
+			inner_report_test(test, outcome, timeout_seconds);
+			co_return;
+		}
+		inner_set_nonblocking(output_pipe[0]);
+
+		const uint64_t start_nanoseconds = inner_monotonic_nanoseconds();
+		error_t error;
+		const pid_t pid = inner_spawn_command(test.cmdline, output_pipe[1], nullptr, error, true);
+		close(output_pipe[1]);
+		if (error != error_t::SUCCESS) {
+			close(output_pipe[0]);
+			job_slots.release();
+			inner_report_test(test, outcome, timeout_seconds);
+			co_return;
+		}
+		outcome.started = true;
+
+		const int group_fd = epoll_create1(EPOLL_CLOEXEC);
+		const int pid_fd = syscall(SYS_pidfd_open, pid, 0);
+		const int timer_fd = timeout_seconds == 0 ? -1 : timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		const uint64_t deadline_nanoseconds = start_nanoseconds + (uint64_t)timeout_seconds * 1000000000;
+		auto kill_test = [&outcome, pid]() {
+			kill(-pid, SIGKILL);
+			outcome.timed_out = true;
+		};
+
+		auto watch = [group_fd](int fd) {
+			if (fd < 0) { return; }
+			epoll_event event { };
+			event.events = EPOLLIN;
+			event.data.fd = fd;
+			epoll_ctl(group_fd, EPOLL_CTL_ADD, fd, &event);
+		};
+		watch(output_pipe[0]);
+		watch(pid_fd);
+		watch(timer_fd);
+		if (timer_fd >= 0) {
+			itimerspec timeout { };
+			timeout.it_value.tv_sec = timeout_seconds;
+			timerfd_settime(timer_fd, 0, &timeout, nullptr);
+		}
+
+		bool output_open = true;
+		bool exited = false;
+		while (!exited && group_fd >= 0) {
+			co_await loop.wait_readable(group_fd);
+
+			epoll_event events[3];
+			const int event_count = epoll_wait(group_fd, events, sizeof(events) / sizeof(*events), 0);
+			for (int i = 0; i < event_count; i++) {
+				const int fd = events[i].data.fd;
+				if (fd == output_pipe[0]) {
+					if (!inner_receive_available(output_pipe[0], outcome.output)) {
+						output_open = false;
+						epoll_ctl(group_fd, EPOLL_CTL_DEL, output_pipe[0], nullptr);
+						if (pid_fd < 0) { exited = true; }
+					}
+				}
+				else if (fd == pid_fd) { exited = true; }
+				else if (fd == timer_fd) {
+					kill_test();
+					epoll_ctl(group_fd, EPOLL_CTL_DEL, timer_fd, nullptr);
+				}
+			}
+		}
+		if (output_open) { inner_receive_available(output_pipe[0], outcome.output); }
+
+		for (int fd : { group_fd, pid_fd, timer_fd, output_pipe[0] }) {
+			if (fd >= 0) { close(fd); }
+		}
+
+		// NOTE: Right after the pidfd fired, this is done on the first try.
+		while (!inner_try_wait_for_command(pid, outcome.exit_code, error)) {
+			if (timeout_seconds != 0 && !outcome.timed_out && inner_monotonic_nanoseconds() >= deadline_nanoseconds) { kill_test(); }
+			loop.enable_child_exit_signals();
+			co_await loop.wait_any_child_exit();
+		}
+		outcome.duration_nanoseconds = inner_monotonic_nanoseconds() - start_nanoseconds;
+		job_slots.release();
+
+		outcome.passed = !outcome.timed_out && error == error_t::SUCCESS && outcome.exit_code == EXIT_SUCCESS;
+		inner_report_test(test, outcome, timeout_seconds);
+	}
+
+	inline task<void> inner_run_tests(const std::vector<test_t> &tests, const std::vector<size_t> &order, size_t max_jobs,
+					  unsigned int timeout_seconds, std::vector<inner_test_outcome> &outcomes) noexcept {
+		async_semaphore job_slots(max_jobs == 0 ? 1 : max_jobs);
+
+		std::vector<task<void>> test_tasks;
+		test_tasks.reserve(order.size());
+		for (size_t index : order) { test_tasks.push_back(inner_run_test(tests[index], timeout_seconds, job_slots, outcomes[index])); }
+		co_await when_all(std::move(test_tasks));
+	}
+
+	// NOTE: Runs the tests concurrently, max_jobs at a time, each with its own timeout (0 means no timeout).
+	// The tests that took longest last time get started first (tests without a history count as the longest),
+	// so the run ends up about as long as the longest test instead of having one slow test start last.
+	// Tests that passed last time and whose command line, executable and inputs haven't changed since get skipped.
+	// Results are kept in build_directory. Failures are reported with the test's captured stdout and stderr.
+	// Returns the number of tests that failed.
+	inline size_t run_tests(const std::vector<test_t> &tests, const lime::string &build_directory, size_t max_jobs, unsigned int timeout_seconds, error_t &error) noexcept {
+		error = error_t::SUCCESS;
+
+		inner_test_results results(build_directory);
+
+		std::vector<uint64_t> fingerprints(tests.size());
+		std::vector<size_t> order;
+		size_t skipped_count = 0;
+		for (size_t i = 0; i < tests.size(); i++) {
+			fingerprints[i] = inner_test_fingerprint(tests[i]);
+			const inner_test_results::record_t *record = results.find(tests[i].name);
+			if (record != nullptr && record->passed && fingerprints[i] != 0 && record->fingerprint == fingerprints[i]) {
+				lime::info("test \"" + tests[i].name + "\" unchanged since it last passed, skipped");
+				skipped_count++;
+				continue;
+			}
+			order.push_back(i);
+		}
+
+		auto expected_duration = [&](size_t index) {
+			const inner_test_results::record_t *record = results.find(tests[index].name);
+			return record == nullptr ? UINT64_MAX : record->duration_nanoseconds;
+		};
+		std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) { return expected_duration(left) > expected_duration(right); });
+
+		std::vector<inner_test_outcome> outcomes(tests.size());
+		sync_wait(inner_run_tests(tests, order, max_jobs, timeout_seconds, outcomes));
+
+		size_t failed_count = 0;
+		for (size_t index : order) {
+			const inner_test_outcome &outcome = outcomes[index];
+			if (!outcome.passed) { failed_count++; }
+			if (outcome.started) { results.set(tests[index].name, { outcome.passed, outcome.duration_nanoseconds, fingerprints[index] }); }
+		}
+		if (!order.empty()) { results.save(); }
+
+		lime::info("tests: " + std::to_string(order.size() - failed_count) + " passed, " + std::to_string(failed_count) + " failed, "
+			   + std::to_string(skipped_count) + " skipped");
+
+		if (failed_count != 0) { error = error_t::CMD_RETURNED_FAILURE; }
+		return failed_count;
+	}
+
+	inline void run_tests(const std::vector<test_t> &tests, const lime::string &build_directory, size_t max_jobs, unsigned int timeout_seconds) noexcept {
+		error_t error;
+		run_tests(tests, build_directory, max_jobs, timeout_seconds, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::CMD_RETURNED_FAILURE:
+			lime::error("lime::run_tests() failed, one or more tests failed");
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::run_tests() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+	}
+
+	// NOTE: For building command lines, quotes the argument if it has spaces in it.
+	inline std::string inner_quote_argument(const std::string &argument) noexcept {
+		if (argument.find(' ') == std::string::npos) { return argument; }
+		return '\"' + argument + '\"';
+	}
+
+	// NOTE: Reads how long every test case took from a googletest XML report, in nanoseconds, keyed by "Suite.Test".
+	// Only the <testcase> elements are looked at, test cases that didn't run (disabled, filtered out) are left out.
+	inline void inner_parse_gtest_report(const std::string &xml, std::unordered_map<std::string, uint64_t> &durations) noexcept {
+		auto get_attribute = [](std::string_view element, std::string_view name) {
+			const std::string pattern = ' ' + std::string(name) + "=\"";
+			const size_t value_start = element.find(pattern);
+			if (value_start == std::string_view::npos) { return std::string(); }
+			const size_t value_end = element.find('\"', value_start + pattern.size());
+			if (value_end == std::string_view::npos) { return std::string(); }
+			return std::string(element.substr(value_start + pattern.size(), value_end - value_start - pattern.size()));
+		};
+
+		for (size_t element_start = 0; (element_start = xml.find("<testcase ", element_start)) != std::string::npos; ) {
+			const size_t element_end = xml.find('>', element_start);
+			if (element_end == std::string::npos) { return; }
+			const std::string_view element(xml.data() + element_start, element_end - element_start);
+			element_start = element_end;
+
+			const std::string name = get_attribute(element, "name");
+			const std::string suite = get_attribute(element, "classname");
+			const std::string time = get_attribute(element, "time");
+			if (name.empty() || suite.empty() || time.empty() || get_attribute(element, "status") == "notrun") { continue; }
+			const double seconds = std::strtod(time.c_str(), nullptr);
+			durations[suite + '.' + name] = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+		}
+	}
+
+	// NOTE: Splits a googletest binary into shard_count tests, each one running its part of the test cases
+	// through --gtest_filter. The test cases are listed with --gtest_list_tests.
+	// Every shard writes an XML report into build_directory, and the durations in there are used to split the test cases
+	// next time: longest first, each into the shard with the least expected time so far, so the shards take about equally long.
+	// Test cases without a recorded duration count as the average one. The split is remembered and only redone
+	// when the executable or shard_count changes, so the shards' command lines stay the same and
+	// run_tests can still skip the ones that passed.
+	inline std::vector<test_t> gtest_shards(const lime::string &executable, size_t shard_count, const std::vector<lime::string> &inputs,
+						const lime::string &build_directory, error_t &error) noexcept {
+		std::string listing;
+		const int exit_code = inner_capture_command(executable + " --gtest_list_tests", listing, error);
+		if (error != error_t::SUCCESS) { return { }; }
+		if (exit_code != EXIT_SUCCESS) { error = error_t::CMD_RETURNED_FAILURE; return { }; }
+
+		// NOTE: Suite lines start in the first column and end with a dot, test lines are indented.
+		// Both can be followed by a comment about type or value parameters.
+		std::vector<std::string> test_cases;
+		std::string suite;
+		std::vector<std::string_view> lines;
+		inner_split_views(listing, "\n", lines);
+		for (std::string_view line : lines) {
+			if (line.empty()) { continue; }
+			const bool indented = line[0] == ' ';
+			const size_t name_start = line.find_first_not_of(' ');
+			const size_t name_end = line.find_first_of(" #", name_start);
+			const std::string_view name = line.substr(name_start, name_end == std::string_view::npos ? std::string_view::npos : name_end - name_start);
+			if (!indented) { suite = name; }
+			else if (!suite.empty()) { test_cases.push_back(suite + std::string(name)); }
+		}
+
+		if (shard_count == 0) { shard_count = 1; }
+		if (shard_count > test_cases.size()) { shard_count = test_cases.size() == 0 ? 1 : test_cases.size(); }
+
+		std::string state_name = executable.to_std_string();
+		std::replace(state_name.begin(), state_name.end(), '/', '_');
+		const std::string state_prefix = build_directory.to_std_string() + "/.lime_gtest/" + state_name;
+		const std::string split_path = state_prefix + ".split";
+		auto get_report_path = [&state_prefix](size_t shard) { return state_prefix + ".shard" + std::to_string(shard) + ".xml"; };
+
+		// NOTE: The first line identifies the executable the split was made for, then there's one filter per line.
+		std::string identity;
+		struct stat stat_buf;
+		if (inner_stat(executable.c_str(), &stat_buf) == 0) {
+			identity = std::to_string(stat_buf.st_dev) + ' ' + std::to_string(stat_buf.st_ino) + ' ' + std::to_string(stat_buf.st_size) + ' '
+				   + std::to_string(stat_buf.st_mtim.tv_sec) + ' ' + std::to_string(stat_buf.st_mtim.tv_nsec) + ' ' + std::to_string(shard_count);
+		}
+
+		std::vector<std::string> filters;
+		std::string split;
+		if (!identity.empty() && inner_read_file(split_path.c_str(), split)) {
+			std::vector<std::string_view> split_lines;
+			inner_split_views(split, "\n", split_lines);
+			if (!split_lines.empty() && split_lines.back().empty()) { split_lines.pop_back(); }
+			if (split_lines.size() == shard_count + 1 && split_lines[0] == identity) {
+				for (size_t i = 1; i < split_lines.size(); i++) { filters.emplace_back(split_lines[i]); }
+			}
+		}
+
+		if (filters.empty()) {
+			std::unordered_map<std::string, uint64_t> durations;
+			for (size_t shard = 0; ; shard++) {
+				std::string report;
+				if (!inner_read_file(get_report_path(shard).c_str(), report)) { break; }
+				inner_parse_gtest_report(report, durations);
+			}
+
+			uint64_t known_total = 0;
+			size_t known_count = 0;
+			for (const std::string &test_case : test_cases) {
+				auto duration = durations.find(test_case);
+				if (duration != durations.end()) { known_total += duration->second; known_count++; }
+			}
+			const uint64_t default_duration = known_count == 0 ? 1 : known_total / known_count;
+			auto expected_duration = [&](const std::string &test_case) {
+				auto duration = durations.find(test_case);
+				return duration == durations.end() ? default_duration : duration->second;
+			};
+
+			std::vector<size_t> order(test_cases.size());
+			for (size_t i = 0; i < order.size(); i++) { order[i] = i; }
+			std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) { return expected_duration(test_cases[left]) > expected_duration(test_cases[right]); });
+
+			filters.resize(shard_count);
+			std::vector<uint64_t> shard_durations(shard_count, 0);
+			for (size_t index : order) {
+				const size_t shard = std::min_element(shard_durations.begin(), shard_durations.end()) - shard_durations.begin();
+				shard_durations[shard] += expected_duration(test_cases[index]);
+				if (!filters[shard].empty()) { filters[shard] += ':'; }
+				filters[shard] += test_cases[index];
+			}
+
+			// NOTE: Reports of shards that don't exist anymore would only feed stale durations into the next split.
+			for (size_t shard = shard_count; unlink(get_report_path(shard).c_str()) == 0; shard++) { }
+
+			if (!identity.empty()) {
+				std::string content = identity + '\n';
+				for (const std::string &filter : filters) { content += filter + '\n'; }
+				if (!inner_atomic_write_file(split_path, content)) {
+					lime::warn("lime::gtest_shards() failed to write \"" + split_path + "\", the shards will be split again next time");
+				}
+			}
+		}
+
+		std::vector<test_t> result(shard_count);
+		for (size_t i = 0; i < shard_count; i++) {
+			result[i].name = executable + " [shard " + lime::string(std::to_string(i + 1) + '/' + std::to_string(shard_count)) + ']';
+			result[i].cmdline = executable + lime::string(filters[i].empty() ? std::string() : " --gtest_filter=" + filters[i])
+					    + lime::string(" --gtest_output=xml:" + inner_quote_argument(get_report_path(i)));
+			result[i].inputs = inputs;
+		}
+		return result;
+	}
+
+	inline std::vector<test_t> gtest_shards(const lime::string &executable, size_t shard_count, const std::vector<lime::string> &inputs, const lime::string &build_directory) noexcept {
+		error_t error;
+		std::vector<test_t> result = gtest_shards(executable, shard_count, inputs, build_directory, error);
+
+		switch (error) {
+		case error_t::SUCCESS: break;
+
+		case error_t::CMD_INVOKE_FAILED:
+		case error_t::CMD_RETURNED_FAILURE:
+			lime::error("lime::gtest_shards() failed, couldn't list the tests of \"" + executable + '\"');
+			lime::exit_program(EXIT_FAILURE);
+
+		default:
+			lime::bug("lime::gtest_shards() failed, unknown error");
+			lime::exit_program(EXIT_FAILURE);
+		}
+
+		return result;
+	}
+
+	struct unity_unit {
+		lime::string source;			// NOTE: The generated wrapper for batches, the file itself for files compiled on their own.
+		std::vector<lime::string> members;	// NOTE: The sources that end up in this translation unit, in #include order.
+		bool is_batch;
+	};
+
+	// NOTE: Groups sources into unity (jumbo) translation units, so shared headers get parsed once per batch instead of once per file.
+	// Batch membership is remembered in the unity directory and kept as stable as possible: new files go into a batch
+	// that has room (preferably one from the same directory), removed files just leave their batch, nothing gets
+	// reshuffled. Wrappers are only rewritten when their contents change, so their mtimes only move when membership does.
+	// Batches are full at max_batch_size files, or earlier once the estimated compile time of the members reaches
+	// the target cost, if one is set. Compile times are learned through record_compile_time().
+	// With adaptive mode on (the default), a source that changed since the last plan() is pulled out of its batch
+	// and compiled on its own from then on, so editing it again only rebuilds that one file.
+	// merge_working_set() puts those files back into the batches they came from, for full or CI builds for example.
+	class unity_batcher {
+		static constexpr const char *MANIFEST_FILENAME = ".lime_unity_batches";
+
+		struct member_t {
+			std::string path;
+			uint64_t cost_nanoseconds;	// NOTE: 0 if unknown.
+			timespec mtime;
+			uint32_t home_batch_id = UINT32_MAX;	// NOTE: For the working set, the batch the file was pulled out of.
+		};
+
+		struct batch_t {
+			uint32_t id;
+			std::vector<member_t> members;
+		};
+
+		std::string unity_directory;
+		std::vector<batch_t> batches;
+		std::vector<member_t> working_set;
+		std::unordered_set<std::string> excluded;
+		size_t max_batch_size = 16;
+		uint64_t target_cost_nanoseconds = 0;
+		bool adaptive = true;
+		bool dirty = false;
+
+		std::string manifest_path() const noexcept { return unity_directory + '/' + MANIFEST_FILENAME; }
+
+		std::string wrapper_path(uint32_t id) const noexcept {
+			char name[32];
+			std::snprintf(name, sizeof(name), "unity_%04u.cpp", id);
+			return unity_directory + '/' + name;
+		}
+
+		static std::string directory_of(const std::string &path) noexcept { return path.substr(0, path.rfind('/')); }
+
+		void load() noexcept {
+			std::string content;
+			if (!inner_read_file(manifest_path().c_str(), content)) { return; }
+
+			batch_t *current_batch = nullptr;
+			inner_for_each_line(content, [&](const std::string &line) {
+				if (line.size() < 2 || line[1] != ' ') { return; }
+
+				if (line[0] == 'B') {
+					unsigned int id;
+					if (std::sscanf(line.c_str() + 2, "%u", &id) != 1) { current_batch = nullptr; return; }
+					batches.push_back({ id, { } });
+					current_batch = &batches.back();
+					return;
+				}
+
+				member_t member;
+				unsigned long long cost_nanoseconds;
+				long long mtime_seconds, mtime_nanoseconds;
+				int fields_offset = 0;
+				int path_offset = 0;
+				// NOTE: Working set lines start with the id of the batch the file came from.
+				if (line[0] == 'W' && std::sscanf(line.c_str() + 2, "%u %n", &member.home_batch_id, &fields_offset) != 1) { return; }
+				if (std::sscanf(line.c_str() + 2 + fields_offset, "%llu %lld %lld %n", &cost_nanoseconds, &mtime_seconds, &mtime_nanoseconds, &path_offset) != 3 || path_offset == 0) { return; }
+				member.path = line.substr(2 + fields_offset + path_offset);
+				member.cost_nanoseconds = cost_nanoseconds;
+				member.mtime = { (time_t)mtime_seconds, (long)mtime_nanoseconds };
+
+				if (line[0] == 'M' && current_batch != nullptr) { current_batch->members.push_back(std::move(member)); }
+				else if (line[0] == 'W') { working_set.push_back(std::move(member)); }
+			});
+		}
+
+		uint64_t estimate_cost(const member_t &member) const noexcept {
+			if (member.cost_nanoseconds != 0 || target_cost_nanoseconds == 0) { return member.cost_nanoseconds; }
+			return target_cost_nanoseconds / (max_batch_size == 0 ? 1 : max_batch_size);
+		}
+
+		bool fits(const batch_t &batch, const member_t &member) const noexcept {
+			if (batch.members.size() >= max_batch_size) { return false; }
+			if (target_cost_nanoseconds == 0 || batch.members.empty()) { return true; }
+			uint64_t cost = estimate_cost(member);
+			for (const member_t &existing : batch.members) { cost += estimate_cost(existing); }
+			return cost <= target_cost_nanoseconds;
+		}
+
+		void assign(member_t member) noexcept {
+			batch_t *target = nullptr;
+			const std::string directory = directory_of(member.path);
+			for (batch_t &batch : batches) {
+				if (!fits(batch, member)) { continue; }
+				if (!batch.members.empty() && directory_of(batch.members[0].path) == directory) { target = &batch; break; }
+				target = &batch;
+			}
+
+			if (target == nullptr) {
+				uint32_t id = 0;
+				for (const batch_t &batch : batches) { id = std::max(id, batch.id + 1); }
+				batches.push_back({ id, { } });
+				target = &batches.back();
+			}
+			target->members.push_back(std::move(member));
+		}
+
+		bool write_wrapper(const batch_t &batch) const noexcept {
+			std::string content = "// NOTE: Generated by lime::unity_batcher, don't edit.\n";
+			for (const member_t &member : batch.members) { content += "#include \"" + member.path + "\"\n"; }
+
+			const std::string path = wrapper_path(batch.id);
+			std::string existing_content;
+			if (inner_read_file(path.c_str(), existing_content) && existing_content == content) { return true; }
+			return inner_make_parent_directories(path) && inner_write_file(path.c_str(), content);
+		}
+
+	public:
+		unity_batcher(const lime::string &unity_directory) noexcept : unity_directory(inner_absolute_normalize(unity_directory.to_std_string())) { load(); }
+
+		unity_batcher(const unity_batcher&) = delete;
+		unity_batcher& operator=(const unity_batcher&) = delete;
+
+		~unity_batcher() noexcept { save(); }
+
+		void set_max_batch_size(size_t new_max_batch_size) noexcept { max_batch_size = new_max_batch_size == 0 ? 1 : new_max_batch_size; }
+
+		// NOTE: 0 turns cost-based batching off, batches are then only limited by max_batch_size.
+		void set_target_batch_cost(uint64_t nanoseconds) noexcept { target_cost_nanoseconds = nanoseconds; }
+
+		void set_adaptive(bool new_adaptive) noexcept { adaptive = new_adaptive; }
+
+		// NOTE: Never batches the source, for files that don't survive being in a unity TU (clashing statics and such).
+		void exclude(const lime::string &source) noexcept { excluded.insert(inner_absolute_normalize(source.to_std_string())); }
+
+		void merge_working_set() noexcept {
+			for (member_t &member : working_set) {
+				// NOTE: Going back where it came from restores the batch as it was, instead of disturbing a second one.
+				auto home = std::find_if(batches.begin(), batches.end(), [&member](const batch_t &batch) { return batch.id == member.home_batch_id; });
+				if (home == batches.end() && member.home_batch_id != UINT32_MAX) {
+					batches.push_back({ member.home_batch_id, { } });
+					home = batches.end() - 1;
+				}
+				member.home_batch_id = UINT32_MAX;
+				if (home != batches.end() && fits(*home, member)) { home->members.push_back(std::move(member)); }
+				else { assign(std::move(member)); }
+			}
+			working_set.clear();
+			dirty = true;
+		}
+
+		// NOTE: Takes the time it took to compile one of the units from plan(). A batch's time gets spread over its members
+		// by file size, which is good enough to get an idea of which files are expensive.
+		void record_compile_time(const lime::string &unit_source, uint64_t nanoseconds) noexcept {
+			const std::string path = inner_absolute_normalize(unit_source.to_std_string());
+
+			for (batch_t &batch : batches) {
+				if (wrapper_path(batch.id) != path) { continue; }
+
+				std::vector<uint64_t> sizes;
+				uint64_t total_size = 0;
+				for (const member_t &member : batch.members) {
+					struct stat stat_buf;
+					sizes.push_back(inner_stat(member.path.c_str(), &stat_buf) == 0 ? stat_buf.st_size + 1 : 1);
+					total_size += sizes.back();
+				}
+				for (size_t i = 0; i < batch.members.size(); i++) {
+					batch.members[i].cost_nanoseconds = (uint64_t)((double)nanoseconds * sizes[i] / total_size) + 1;
+				}
+				dirty = true;
+				return;
+			}
+
+			for (member_t &member : working_set) {
+				if (member.path == path) { member.cost_nanoseconds = nanoseconds + 1; dirty = true; return; }
+			}
+		}
+
+		// NOTE: Brings the batches up to date with the given sources, writes the wrappers that changed and returns
+		// every translation unit that has to be compiled: the batches, and the files that are compiled on their own.
+		std::vector<unity_unit> plan(const std::vector<lime::string> &sources, error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			std::unordered_map<std::string, timespec> wanted;
+			std::vector<std::string> wanted_order;
+			for (const lime::string &source : sources) {
+				const std::string path = inner_absolute_normalize(source.to_std_string());
+				struct stat stat_buf;
+				if (inner_stat(path.c_str(), &stat_buf) < 0) { error = error_t::ERRNO; return { }; }
+				if (wanted.emplace(path, stat_buf.st_mtim).second) { wanted_order.push_back(path); }
+			}
+
+			std::unordered_set<std::string> placed;
+			std::vector<member_t> standalone;
+
+			for (batch_t &batch : batches) {
+				std::vector<member_t> kept_members;
+				for (member_t &member : batch.members) {
+					auto source = wanted.find(member.path);
+					if (source == wanted.end() || excluded.count(member.path) != 0) { dirty = true; continue; }
+
+					const bool changed = member.mtime.tv_sec != source->second.tv_sec || member.mtime.tv_nsec != source->second.tv_nsec;
+					member.mtime = source->second;
+					if (changed) { dirty = true; }
+					if (changed && adaptive) {
+						member.home_batch_id = batch.id;
+						working_set.push_back(std::move(member));
+						continue;
+					}
+					placed.insert(member.path);
+					kept_members.push_back(std::move(member));
+				}
+				batch.members = std::move(kept_members);
+			}
+
+			std::vector<member_t> kept_working_set;
+			for (member_t &member : working_set) {
+				auto source = wanted.find(member.path);
+				if (source == wanted.end() || excluded.count(member.path) != 0 || !placed.insert(member.path).second) { dirty = true; continue; }
+				member.mtime = source->second;
+				kept_working_set.push_back(std::move(member));
+			}
+			working_set = std::move(kept_working_set);
+
+			for (const std::string &path : wanted_order) {
+				if (placed.count(path) != 0) { continue; }
+				if (excluded.count(path) != 0) { standalone.push_back({ path, 0, wanted[path] }); continue; }
+				assign({ path, 0, wanted[path] });
+				dirty = true;
+			}
+
+			std::vector<unity_unit> result;
+			std::vector<batch_t> kept_batches;
+			for (batch_t &batch : batches) {
+				if (batch.members.empty()) {
+					unlink(wrapper_path(batch.id).c_str());
+					dirty = true;
+					continue;
+				}
+				if (!write_wrapper(batch)) { error = error_t::ERRNO; return { }; }
+
+				unity_unit unit { wrapper_path(batch.id), { }, true };
+				for (const member_t &member : batch.members) { unit.members.push_back(member.path); }
+				result.push_back(std::move(unit));
+				kept_batches.push_back(std::move(batch));
+			}
+			batches = std::move(kept_batches);
+
+			for (const member_t &member : working_set) { result.push_back({ member.path, { member.path }, false }); }
+			for (const member_t &member : standalone) { result.push_back({ member.path, { member.path }, false }); }
+
+			return result;
+		}
+
+		std::vector<unity_unit> plan(const std::vector<lime::string> &sources) noexcept {
+			error_t error;
+			std::vector<unity_unit> result = plan(sources, error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::ERRNO:
+				lime::error("lime::unity_batcher::plan() failed, a source is missing or a wrapper couldn't be written");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::unity_batcher::plan() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			return result;
+		}
+
+		void save() noexcept {
+			if (!dirty) { return; }
+
+			std::string content;
+			char line_start[96];
+			auto add_member = [&content, &line_start](char type, const member_t &member) {
+				if (type == 'W') { content += "W " + std::to_string(member.home_batch_id); }
+				else { content += type; }
+				std::snprintf(line_start, sizeof(line_start), " %llu %lld %lld ", (unsigned long long)member.cost_nanoseconds,
+						(long long)member.mtime.tv_sec, (long long)member.mtime.tv_nsec);
+				content += line_start;
+				content += member.path;
+				content += '\n';
+			};
+			for (const batch_t &batch : batches) {
+				content += "B " + std::to_string(batch.id) + '\n';
+				for (const member_t &member : batch.members) { add_member('M', member); }
+			}
+			for (const member_t &member : working_set) { add_member('W', member); }
+
+			const std::string path = manifest_path();
+			if (!inner_atomic_write_file(path, content)) {
+				lime::warn("lime::unity_batcher failed to write \"" + path + "\", batches might get reshuffled next run");
+				return;
+			}
+			dirty = false;
+		}
+	};
+
+	// NOTE: Lexical, both paths have to be absolute and normalized.
+	inline std::string inner_relative_path(const std::string &from_directory, const std::string &to_path) noexcept {
+		std::vector<std::string_view> from_elements;
+		std::vector<std::string_view> to_elements;
+		inner_split_views(std::string_view(from_directory).substr(1), "/", from_elements);
+		inner_split_views(std::string_view(to_path).substr(1), "/", to_elements);
+		if (from_elements.back().empty()) { from_elements.pop_back(); }
+		if (to_elements.back().empty()) { to_elements.pop_back(); }
+
+		size_t common_count = 0;
+		while (common_count < from_elements.size() && common_count < to_elements.size() && from_elements[common_count] == to_elements[common_count]) { common_count++; }
+
+		std::string result;
+		for (size_t i = common_count; i < from_elements.size(); i++) { result += "../"; }
+		for (size_t i = common_count; i < to_elements.size(); i++) {
+			result += to_elements[i];
+			result += '/';
+		}
+		if (result.empty()) { return "."; }
+		result.pop_back();
+		return result;
+	}
+
+	// NOTE: Static library target that only touches what changed. Next to the archive, a manifest remembers the size
+	// and mtime of every member as it was when it went in, so a one-file edit turns into a single "ar r" with that one object
+	// instead of writing out all of them again. Removed members get deleted from the archive, and the symbol index
+	// is written once at the end of each update, not once per change.
+	// Thin archives (set_thin(true)) only store references to the objects, so they're tiny and updating them is cheap.
+	// Regular archives match members by file name, so if two members have the same file name, they're rebuilt from scratch.
+	// Anything unexpected (the archive changed behind our back, switching between thin and regular, a failed update)
+	// also means a rebuild from scratch.
+	class archive {
+		static constexpr const char *MANIFEST_SUFFIX = ".lime_members";
+
+		struct member_record_t {
+			long long size;
+			timespec mtime;
+		};
+
+		std::string path;
+		std::string archiver = "ar";
+		bool thin = false;
+		std::vector<std::string> members;
+		std::unordered_set<std::string> member_set;
+
+		static bool same_record(const member_record_t &record, const struct stat &stat_buf) noexcept {
+			return record.size == (long long)stat_buf.st_size && record.mtime.tv_sec == stat_buf.st_mtim.tv_sec && record.mtime.tv_nsec == stat_buf.st_mtim.tv_nsec;
+		}
+
+		std::string manifest_path() const noexcept { return path + MANIFEST_SUFFIX; }
+
+		// NOTE: Returns false if there's no usable manifest, which means the archive has to be built from scratch.
+		bool load_manifest(std::unordered_map<std::string, member_record_t> &records) const noexcept {
+			std::string content;
+			if (!inner_read_file(manifest_path().c_str(), content)) { return false; }
+
+			bool header_matches = false;
+			bool usable = true;
+			inner_for_each_line(content, [&](const std::string &line) {
+				if (!usable) { return; }
+
+				member_record_t record;
+				long long mtime_seconds, mtime_nanoseconds;
+				int offset = 0;
+				if (line.size() > 2 && line[0] == 'A') {
+					int was_thin;
+					if (std::sscanf(line.c_str() + 2, "%d %lld %lld %lld", &was_thin, &record.size, &mtime_seconds, &mtime_nanoseconds) != 4) { usable = false; return; }
+					record.mtime = { (time_t)mtime_seconds, (long)mtime_nanoseconds };
+
+					struct stat stat_buf;
+					if (inner_stat(path.c_str(), &stat_buf) < 0 || !same_record(record, stat_buf) || (was_thin != 0) != thin) { usable = false; return; }
+					header_matches = true;
+				}
+				else if (line.size() > 2 && line[0] == 'M') {
+					if (std::sscanf(line.c_str() + 2, "%lld %lld %lld %n", &record.size, &mtime_seconds, &mtime_nanoseconds, &offset) != 3 || offset == 0) { usable = false; return; }
+					record.mtime = { (time_t)mtime_seconds, (long)mtime_nanoseconds };
+					records[line.substr(2 + offset)] = record;
+				}
+			});
+			return usable && header_matches;
+		}
+
+		bool write_manifest(const std::vector<struct stat> &member_stats) const noexcept {
+			struct stat archive_stat;
+			if (inner_stat(path.c_str(), &archive_stat) < 0) { return false; }
+
+			char line_start[96];
+			std::snprintf(line_start, sizeof(line_start), "A %d %lld %lld %lld\n", thin ? 1 : 0, (long long)archive_stat.st_size,
+					(long long)archive_stat.st_mtim.tv_sec, (long long)archive_stat.st_mtim.tv_nsec);
+			std::string content = line_start;
+			for (size_t i = 0; i < members.size(); i++) {
+				std::snprintf(line_start, sizeof(line_start), "M %lld %lld %lld ", (long long)member_stats[i].st_size,
+						(long long)member_stats[i].st_mtim.tv_sec, (long long)member_stats[i].st_mtim.tv_nsec);
+				content += line_start;
+				content += members[i];
+				content += '\n';
+			}
+
+			return inner_atomic_write_file(manifest_path(), content);
+		}
+
+		bool has_duplicate_file_names() const noexcept {
+			std::unordered_set<std::string> file_names;
+			for (const std::string &member : members) {
+				if (!file_names.insert(member.substr(member.rfind('/') + 1)).second) { return true; }
+			}
+			return false;
+		}
+
+		// NOTE: ar runs in the archive's directory and gets the members relative to it, that's how thin archives
+		// store them, and it's the only way "r" and "d" reliably match the members that are already in there.
+		bool run_archiver(const std::string &operation, const std::vector<std::string> &arguments, error_t &error) const noexcept {
+			const std::string directory = path.substr(0, path.rfind('/') == 0 ? 1 : path.rfind('/'));
+
+			std::string cmdline = inner_quote_argument(archiver) + ' ' + operation + (thin ? "TP " : " ") + inner_quote_argument(path.substr(path.rfind('/') + 1));
+			for (const std::string &argument : arguments) { cmdline += ' ' + inner_quote_argument(inner_relative_path(directory, argument)); }
+
+			lime::cmd_label(cmdline);
+			inner_execute_command(cmdline, directory.c_str(), error);
+			return error == error_t::SUCCESS;
+		}
+
+	public:
+		archive(const lime::string &path) noexcept : path(inner_absolute_normalize(path.to_std_string())) { }
+
+		void set_thin(bool new_thin) noexcept { thin = new_thin; }
+		void set_archiver(const lime::string &new_archiver) noexcept { archiver = new_archiver.to_std_string(); }
+
+		void add_member(const lime::string &object_path) noexcept {
+			std::string member = inner_absolute_normalize(object_path.to_std_string());
+			if (member_set.insert(member).second) { members.push_back(std::move(member)); }
+		}
+
+		void add_members(const std::vector<lime::string> &object_paths) noexcept {
+			for (const lime::string &object_path : object_paths) { add_member(object_path); }
+		}
+
+		// NOTE: The members that are new or changed since the last build(). Every member, if the archive has to be rebuilt from scratch.
+		std::vector<lime::string> get_stale_members(error_t &error) const noexcept {
+			error = error_t::SUCCESS;
+
+			std::unordered_map<std::string, member_record_t> records;
+			const bool incremental = load_manifest(records);
+
+			std::vector<lime::string> result;
+			for (const std::string &member : members) {
+				struct stat stat_buf;
+				if (inner_stat(member.c_str(), &stat_buf) < 0) { error = error_t::ERRNO; return { }; }
+				auto record = records.find(member);
+				if (!incremental || record == records.end() || !same_record(record->second, stat_buf)) { result.push_back(member); }
+			}
+			return result;
+		}
+
+		// NOTE: Brings the archive up to date. Returns true if the archiver had to run.
+		bool build(error_t &error) noexcept {
+			error = error_t::SUCCESS;
+
+			std::vector<struct stat> member_stats(members.size());
+			for (size_t i = 0; i < members.size(); i++) {
+				if (inner_stat(members[i].c_str(), &member_stats[i]) < 0) { error = error_t::ERRNO; return false; }
+			}
+
+			std::unordered_map<std::string, member_record_t> records;
+			bool from_scratch = !load_manifest(records) || (!thin && has_duplicate_file_names());
+
+			std::vector<std::string> changed_members;
+			for (size_t i = 0; i < members.size(); i++) {
+				auto record = records.find(members[i]);
+				if (record == records.end() || !same_record(record->second, member_stats[i])) { changed_members.push_back(members[i]); }
+			}
+			std::vector<std::string> removed_members;
+			for (const std::pair<const std::string, member_record_t> &record : records) {
+				if (member_set.count(record.first) == 0) { removed_members.push_back(record.first); }
+			}
+
+			if (!from_scratch && changed_members.empty() && removed_members.empty()) { return false; }
+
+			lime::info('\"' + path + '\"' + " is out-of-date, updating " + std::to_string(from_scratch ? members.size() : changed_members.size() + removed_members.size()) + " members...");
+
+			// NOTE: If anything goes wrong from here on, the manifest can't be trusted anymore.
+			unlink(manifest_path().c_str());
+
+			if (from_scratch) {
+				if (unlink(path.c_str()) < 0 && errno != ENOENT) { error = error_t::ERRNO; return true; }
+				if (!inner_make_parent_directories(path)) { error = error_t::ERRNO; return true; }
+				if (!run_archiver("qcsD", members, error)) { return true; }
+			}
+			else {
+				if (!removed_members.empty() && !run_archiver("dSD", removed_members, error)) { return true; }
+				// NOTE: This is the one place the symbol index gets written, for all the changes at once.
+				if (!run_archiver(changed_members.empty() ? "sD" : "rsD", changed_members, error)) { return true; }
+			}
+
+			if (!write_manifest(member_stats)) { lime::warn("failed to write \"" + manifest_path() + "\", the archive will be rebuilt from scratch next time"); }
+			lime::info('\"' + path + '\"' + " updated");
+			return true;
+		}
+
+		bool build() noexcept {
+			error_t error;
+			bool result = build(error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::ERRNO:
+				lime::error("lime::archive::build() failed, a member is missing or the archive couldn't be written");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_INVOKE_FAILED:
+				lime::error("lime::archive::build() failed, the archiver couldn't be started");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_RETURNED_FAILURE:
+				lime::error("lime::archive::build() failed, the archiver failed");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::archive::build() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			return result;
+		}
+	};
+
+	// NOTE: Link step for an executable or a shared library. The linker is the fastest one the toolchain can use
+	// (mold, lld or gold, see toolchain::get_fast_linker()) running on all cores, and relinking only happens
+	// if an input or the link command itself changed, with early cutoff through the cutoff_db.
+	// The link command is kept in a file next to the output that only gets rewritten when the command changes,
+	// and that file counts as an input, so different flags, a different linker or a removed object relink too.
+	// Shared libraries also write an interface file next to them, the list of symbols they export, which only gets rewritten
+	// if that list changed. Whatever links against a shared library target depends on that file instead of the library itself,
+	// so an edit inside one library relinks that one library and nothing else, as long as its exported symbols stay the same.
+	// With set_split_debug_info(true), debug info stays in .dwo files next to the objects instead of going through the linker,
+	// and the linker writes a .gdb_index so that gdb doesn't have to build one on every start.
+	// The objects have to be compiled with get_compile_flags() for that to work.
+	class link_target {
+		static constexpr const char *INTERFACE_SUFFIX = ".lime_interface";
+		static constexpr const char *COMMAND_SUFFIX = ".lime_link_command";
+
+		toolchain *compiler;
+		std::string output_path;
+		std::vector<lime::string> dependencies;
+		std::string inputs;
+		std::string flags;
+		bool shared = false;
+		bool split_debug_info = false;
+		unsigned int thread_count = 0;
+
+		std::string linker_flags;
+		bool linker_resolved = false;
+
+		void resolve_linker() noexcept {
+			if (linker_resolved) { return; }
+			linker_resolved = true;
+
+			unsigned int threads = thread_count;
+			if (threads == 0) {
+				long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+				threads = processor_count > 0 ? (unsigned int)processor_count : 1;
+			}
+
+			const lime::string linker = compiler->get_fast_linker();
+			linker_flags = compiler->get_linker_flags(linker, threads).to_std_string();
+			// NOTE: The default linker is usually ld.bfd, which doesn't know --gdb-index.
+			if (split_debug_info && compiler->supports_flag(linker_flags + " -Wl,--gdb-index")) { linker_flags += " -Wl,--gdb-index"; }
+		}
+
+		// NOTE: Writes the list of exported symbols to the interface file, unless the file already has exactly that list.
+		// Only names and types go in, because addresses move with every edit of a function body. Data objects also keep
+		// their size, since executables copy-relocate them and have to be relinked when it changes.
+		// If the list can't be read, the interface file gets rewritten every time, so dependents always relink.
+		void update_interface() const noexcept {
+			const std::string interface_path = output_path + INTERFACE_SUFFIX;
+
+			std::string listing;
+			std::string symbols;
+			error_t error;
+			int exit_code = inner_capture_command("nm -D --defined-only --portability " + inner_quote_argument(output_path), listing, error);
+			if (error != error_t::SUCCESS || exit_code != EXIT_SUCCESS) {
+				lime::warn("couldn't list the symbols exported by \"" + output_path + "\", everything that links against it gets relinked");
+				symbols = "unknown " + std::to_string(inner_monotonic_nanoseconds()) + '\n';
+			}
+			else {
+				// NOTE: The POSIX format is "<name> <type> <value> <size>", the size is missing for some symbols.
+				inner_for_each_line(listing, [&symbols](const std::string &line) {
+					const size_t type_start = line.find(' ') + 1;
+					const size_t type_end = line.find(' ', type_start);
+					symbols.append(line, 0, type_end);
+					const char type = type_end == std::string::npos ? 0 : std::toupper((unsigned char)line[type_start]);
+					if (type == 'B' || type == 'D' || type == 'G' || type == 'R' || type == 'S' || type == 'V') {
+						const size_t value_end = line.find(' ', type_end + 1);
+						if (value_end != std::string::npos) { symbols.append(line, value_end, std::string::npos); }
+					}
+					symbols += '\n';
+				});
+			}
+
+			std::string previous_symbols;
+			if (inner_read_file(interface_path.c_str(), previous_symbols) && previous_symbols == symbols) { return; }
+
+			if (!inner_atomic_write_file(interface_path, symbols)) {
+				unlink(interface_path.c_str());
+				lime::warn("failed to write \"" + interface_path + "\", everything that links against \"" + output_path + "\" will fail to link until it's relinked");
+			}
+		}
+
+	public:
+		link_target(toolchain &compiler, const lime::string &output_path) noexcept : compiler(&compiler), output_path(output_path.to_std_string()) { }
+
+		void set_shared(bool new_shared) noexcept { shared = new_shared; }
+		void set_split_debug_info(bool new_split_debug_info) noexcept { split_debug_info = new_split_debug_info; linker_resolved = false; }
+
+		// NOTE: 0, the default, means one thread per core.
+		void set_thread_count(unsigned int new_thread_count) noexcept { thread_count = new_thread_count; linker_resolved = false; }
+
+		void add_flags(const lime::string &new_flags) noexcept {
+			flags += ' ';
+			flags += new_flags.to_std_string();
+		}
+
+		void add_object(const lime::string &object_path) noexcept {
+			dependencies.push_back(object_path);
+			inputs += ' ' + inner_quote_argument(object_path.to_std_string());
+		}
+
+		void add_objects(const std::vector<lime::string> &object_paths) noexcept {
+			for (const lime::string &object_path : object_paths) { add_object(object_path); }
+		}
+
+		// NOTE: For static libraries and anything else that goes on the command line and should cause a relink when it changes.
+		void add_library(const lime::string &library_path) noexcept { add_object(library_path); }
+
+		// NOTE: Shared libraries only cause a relink when their interface changed.
+		void add_library(const link_target &library) noexcept {
+			if (!library.shared) { add_object(library.output_path); return; }
+			dependencies.push_back(library.get_interface_path());
+			inputs += ' ' + inner_quote_argument(library.output_path);
+		}
+
+		lime::string get_output_path() const noexcept { return output_path; }
+		lime::string get_interface_path() const noexcept { return output_path + INTERFACE_SUFFIX; }
+
+		// NOTE: What the objects that go into this target should be compiled with on top of everything else.
+		lime::string get_compile_flags() noexcept {
+			std::string result;
+			if (shared) { result += "-fPIC"; }
+			if (split_debug_info && compiler->supports_flag("-gsplit-dwarf")) { result += result.empty() ? "-gsplit-dwarf" : " -gsplit-dwarf"; }
+			return result;
+		}
+
+		lime::string get_link_command() noexcept {
+			resolve_linker();
+
+			std::string cmdline = inner_quote_argument(compiler->get_path().to_std_string());
+			if (!linker_flags.empty()) { cmdline += ' ' + linker_flags; }
+			if (shared) { cmdline += " -shared"; }
+			cmdline += " -o " + inner_quote_argument(output_path) + inputs + flags;
+			return cmdline;
+		}
+
+		// NOTE: Returns true if it had to relink.
+		bool link(cutoff_db &database, error_t &error) noexcept {
+			const lime::string cmdline = get_link_command();
+
+			// NOTE: If the command file can't be written, a changed command just doesn't cause a relink by itself.
+			std::vector<lime::string> link_dependencies = dependencies;
+			const std::string command_path = output_path + COMMAND_SUFFIX;
+			std::string previous_cmdline;
+			if ((inner_read_file(command_path.c_str(), previous_cmdline) && previous_cmdline == cmdline.to_std_string())
+			    || inner_atomic_write_file(command_path, cmdline.to_std_string())) {
+				link_dependencies.push_back(command_path);
+			}
+			else { lime::warn("failed to write \"" + command_path + "\", changing the link command won't cause a relink"); }
+
+			error_t link_error = error_t::SUCCESS;
+			bool relinked = call_if_out_of_date(output_path, link_dependencies, database, [&]() {
+				// NOTE: Linkers that write the output in place would otherwise corrupt a binary that's currently running.
+				unlink(output_path.c_str());
+				lime::cmd_label(cmdline);
+				inner_execute_command(cmdline, link_error);
+			}, error);
+
+			if (link_error != error_t::SUCCESS) { error = link_error; return true; }
+			if (error != error_t::SUCCESS) { return relinked; }
+
+			// NOTE: Also done if nothing was relinked, in case the interface file went missing.
+			if (shared && (relinked || access(get_interface_path().c_str(), F_OK) < 0)) { update_interface(); }
+			return relinked;
+		}
+
+		bool link(cutoff_db &database) noexcept {
+			error_t error;
+			bool result = link(database, error);
+
+			switch (error) {
+			case error_t::SUCCESS: break;
+
+			case error_t::ERRNO:
+				lime::error("lime::link_target::link() failed for \"" + output_path + "\", an input is missing");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_INVOKE_FAILED:
+				lime::error("lime::link_target::link() failed for \"" + output_path + "\", the linker couldn't be started");
+				lime::exit_program(EXIT_FAILURE);
+
+			case error_t::CMD_RETURNED_FAILURE:
+				lime::error("lime::link_target::link() failed for \"" + output_path + "\", the linker failed");
+				lime::exit_program(EXIT_FAILURE);
+
+			default:
+				lime::bug("lime::link_target::link() failed, unknown error");
+				lime::exit_program(EXIT_FAILURE);
+			}
+
+			return result;
+		}
+	};
+
+	// NOTE: Same order as counter_t. Also used as the JSON keys.
+	inline const char *const inner_counter_names[(size_t)counter_t::COUNT] = {
+		"stat", "readlink", "getcwd", "chdir", "glob", "mkdir", "path_parses", "string_bytes_allocated", "spawns", "wait_ns"
+	};
+
+	struct stats_t {
+		uint64_t counters[(size_t)counter_t::COUNT];
+		uint64_t wall_nanoseconds;
+		// NOTE: Wall time minus the time spent waiting on children. With several threads waiting at once,
+		// the waiting time can add up to more than the wall time, this is clamped to 0 in that case.
+		uint64_t driver_nanoseconds;
+	};
+
+	inline stats_t get_stats() noexcept {
+		stats_t result;
+		for (size_t i = 0; i < (size_t)counter_t::COUNT; i++) { result.counters[i] = get_counter((counter_t)i); }
+		result.wall_nanoseconds = inner_monotonic_nanoseconds() - inner_program_start_nanoseconds;
+		const uint64_t wait_nanoseconds = result.counters[(size_t)counter_t::WAIT_NANOSECONDS];
+		result.driver_nanoseconds = wait_nanoseconds < result.wall_nanoseconds ? result.wall_nanoseconds - wait_nanoseconds : 0;
+		return result;
+	}
+
+	inline lime::string stats_summary() noexcept {
+		const stats_t stats = get_stats();
+		auto counter = [&stats](counter_t counter) { return (unsigned long long)stats.counters[(size_t)counter]; };
+
+		char buffer[512];
+		std::snprintf(buffer, sizeof(buffer),
+			"syscalls: stat %llu, readlink %llu, getcwd %llu, chdir %llu, glob %llu, mkdir %llu\n"
+			"%llu path parses, %.2f MiB allocated by lime::string, %llu spawns\n"
+			"%.3f s wall, %.3f s in driver code, %.3f s waiting on children",
+			counter(counter_t::STAT), counter(counter_t::READLINK), counter(counter_t::GETCWD),
+			counter(counter_t::CHDIR), counter(counter_t::GLOB), counter(counter_t::MKDIR),
+			counter(counter_t::PATH_PARSES), counter(counter_t::STRING_BYTES_ALLOCATED) / (1024.0 * 1024.0), counter(counter_t::SPAWNS),
+			stats.wall_nanoseconds / 1e9, stats.driver_nanoseconds / 1e9, counter(counter_t::WAIT_NANOSECONDS) / 1e9);
+		return buffer;
+	}
+
+	// NOTE: One flat object, every counter plus wall_ns and driver_ns. All values are integers.
+	inline lime::string stats_json() noexcept {
+		const stats_t stats = get_stats();
+
+		std::string result = "{";
+		for (size_t i = 0; i < (size_t)counter_t::COUNT; i++) {
+			result += '\"';
+			result += inner_counter_names[i];
+			result += "\":" + std::to_string(stats.counters[i]) + ',';
+		}
+		result += "\"wall_ns\":" + std::to_string(stats.wall_nanoseconds) + ",\"driver_ns\":" + std::to_string(stats.driver_nanoseconds) + '}';
+		return result;
+	}
+
+	inline void print_stats() noexcept {
+		const std::string summary = stats_summary().to_std_string();
+		for (size_t line_start = 0; line_start < summary.size(); ) {
+			size_t line_end = summary.find('\n', line_start);
+			if (line_end == std::string::npos) { line_end = summary.size(); }
+			lime::info("stats: " + summary.substr(line_start, line_end - line_start));
+			line_start = line_end + 1;
+		}
+	}
+
+	inline bool inner_stats_summary_at_exit = false;
+	inline std::string inner_stats_json_path;
+	inline pid_t inner_stats_owner_pid = -1;
+
+	inline void inner_report_stats_at_exit() noexcept {
+		// NOTE: Forked helpers (the spawn server for example) inherit the handler, they shouldn't report anything.
+		if (getpid() != inner_stats_owner_pid) { return; }
+
+		if (inner_stats_summary_at_exit) { lime::print_stats(); }
+		if (inner_stats_json_path.empty()) { return; }
+
+		const std::string json = stats_json().to_std_string() + '\n';
+		if (inner_stats_json_path == "-") {
+			fflush(stdout);
+			inner_write_all(STDOUT_FILENO, json.data(), json.size());
+			return;
+		}
+		if (!inner_make_parent_directories(inner_stats_json_path) || !inner_write_file(inner_stats_json_path.c_str(), json)) {
+			lime::warn("failed to write stats to \"" + inner_stats_json_path + '\"');
+		}
+	}
+
+	// NOTE: Call at the top of main(). Takes "--stats" (print a summary when the build script exits)
+	// and "--stats-json=<path>" (write the stats as JSON to path when the build script exits, "-" is stdout)
+	// out of the arguments, so that the rest of the script never sees them. Returns the new argc.
+	inline int consume_stats_args(int argc, const char **argv) noexcept {
+		int new_argc = 0;
+		bool report = false;
+		for (int i = 0; i < argc; i++) {
+			if (i != 0 && std::strcmp(argv[i], "--stats") == 0) {
+				inner_stats_summary_at_exit = true;
+				report = true;
+				continue;
+			}
+			if (i != 0 && std::strncmp(argv[i], "--stats-json=", 13) == 0) {
+				inner_stats_json_path = argv[i] + 13;
+				report = !inner_stats_json_path.empty() || report;
+				continue;
+			}
+			argv[new_argc++] = argv[i];
+		}
+		argv[new_argc] = nullptr;
+
+		if (report && inner_stats_owner_pid == -1) {
+			inner_stats_owner_pid = getpid();
+			if (std::atexit(inner_report_stats_at_exit) != 0) { lime::warn("failed to register the stats report, no stats will be printed"); }
+		}
+
+		return new_argc;
 	}
 
 	inline void error(const lime::string& message) noexcept {
@@ -1,6 +1,221 @@
 #include "lime_build.h"
 
 #include <ctime>
+#include <cstring>
+#include <map>
+#include <algorithm>
+
+static int failed_checks = 0;
+
+// NOTE: Unlike the output further down, which has to be looked at, these check themselves. main() fails if one of them doesn't hold.
+static void check(bool condition, const lime::string &description) {
+	if (condition) { return; }
+	lime::error("check failed: " + description);
+	failed_checks++;
+}
+
+static void test_find_any_of() {
+	lime::info("");
+	lime::info("byte search kernels against the scalar one");
+
+	std::vector<std::pair<const char*, lime::inner_find_any_of_t>> kernels;
+#ifdef __SSE2__
+	kernels.push_back({ "sse2", lime::inner_find_any_of_sse2 });
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) { kernels.push_back({ "avx2", lime::inner_find_any_of_avx2 }); }
+#endif
+	kernels.push_back({ "dispatched", lime::inner_find_any_of });
+
+	for (const std::pair<const char*, lime::inner_find_any_of_t> &kernel : kernels) {
+		lime::info(kernel.first);
+		check(kernel.second(nullptr, nullptr, '/', '/', '/', '/') == nullptr, lime::string(kernel.first) + ", empty input");
+	}
+
+	// NOTE: Every length up to a few vectors, every start offset within a vector, the match at every position or nowhere.
+	// A second match a bit further on has to lose against the first one. Right behind the end there's a gap of one byte
+	// (a match there would look like no match at all) and then nothing but needles, reading past the end has to find none of them.
+	// One of the needles has the top bit set, chars are signed.
+	const char needles[4] = { '/', '\\', '\"', '\xe9' };
+	char buffer[256];
+	for (size_t offset = 0; offset < 32; offset++) {
+		for (size_t length = 0; length <= 100; length++) {
+			for (size_t match = 0; match <= length; match++) {
+				std::memset(buffer, 'x', sizeof(buffer));
+				char *const head = buffer + offset;
+				char *const end = head + length;
+				for (size_t i = 1; i <= 32; i++) { end[i] = needles[i % 4]; }
+				if (match < length) { head[match] = needles[match % 4]; }
+				if (match + 17 < length) { head[match + 17] = needles[(match + 1) % 4]; }
+
+				const char *expected = lime::inner_find_any_of_scalar(head, end, needles[0], needles[1], needles[2], needles[3]);
+				check(expected == head + match, "scalar, offset " + lime::string(std::to_string(offset)) + ", length " + lime::string(std::to_string(length)));
+				for (const std::pair<const char*, lime::inner_find_any_of_t> &kernel : kernels) {
+					if (kernel.second(head, end, needles[0], needles[1], needles[2], needles[3]) == expected) { continue; }
+					check(false, lime::string(kernel.first) + ", offset " + lime::string(std::to_string(offset)) + ", length " + lime::string(std::to_string(length))
+					      + ", match at " + lime::string(std::to_string(match)));
+				}
+			}
+		}
+	}
+}
+
+static void test_parse_gtest_report() {
+	lime::info("");
+	lime::info("googletest report parsing");
+
+	const std::string report =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<testsuites tests=\"4\" time=\"1.5\" name=\"AllTests\">\n"
+		"  <testsuite name=\"Math\" tests=\"3\" time=\"1.25\">\n"
+		"    <testcase name=\"Add\" status=\"run\" result=\"completed\" time=\"0.5\" classname=\"Math\" />\n"
+		"    <testcase name=\"Sub\" status=\"run\" result=\"completed\" time=\"0.75\" classname=\"Math\">\n"
+		"      <failure message=\"x\" type=\"\"></failure>\n"
+		"    </testcase>\n"
+		"    <testcase name=\"DISABLED_Mul\" status=\"notrun\" result=\"suppressed\" time=\"0\" classname=\"Math\" />\n"
+		"  </testsuite>\n"
+		"  <testsuite name=\"Io\" tests=\"1\" time=\"0.25\">\n"
+		"    <testcase name=\"Read\" status=\"run\" result=\"completed\" time=\"-1\" classname=\"Io\" />\n"
+		"    <testcase name=\"NoTime\" status=\"run\" classname=\"Io\" />\n"
+		"  </testsuite>\n"
+		"</testsuites>\n";
+
+	std::unordered_map<std::string, uint64_t> durations;
+	lime::inner_parse_gtest_report(report, durations);
+	check(durations.size() == 3, "three test cases with durations");
+	check(durations.count("Math.Add") != 0 && durations["Math.Add"] == 500000000, "Math.Add took 0.5 s");
+	check(durations.count("Math.Sub") != 0 && durations["Math.Sub"] == 750000000, "failed Math.Sub took 0.75 s");
+	check(durations.count("Io.Read") != 0 && durations["Io.Read"] == 0, "negative time becomes 0");
+	check(durations.count("Math.DISABLED_Mul") == 0, "tests that didn't run are left out");
+
+	// NOTE: A report that got cut off in the middle of an element.
+	durations.clear();
+	lime::inner_parse_gtest_report(report.substr(0, report.find("classname=\"Math\">")), durations);
+	check(durations.size() == 1 && durations.count("Math.Add") != 0, "truncated report keeps the complete test cases");
+
+	durations.clear();
+	lime::inner_parse_gtest_report("", durations);
+	check(durations.empty(), "empty report");
+}
+
+static void test_unity_batcher_stability() {
+	lime::info("");
+	lime::info("unity batch stability");
+
+	char directory_template[] = "/tmp/lime_partial_test_XXXXXX";
+	const char *directory = mkdtemp(directory_template);
+	check(directory != nullptr, "temporary directory");
+	if (directory == nullptr) { return; }
+
+	auto source_path = [directory](const char *name) { return lime::string(directory) + '/' + name; };
+	std::vector<lime::string> sources;
+	for (const char *name : { "a/1.cpp", "a/2.cpp", "a/3.cpp", "a/4.cpp", "a/5.cpp", "b/1.cpp", "b/2.cpp", "b/3.cpp", "c/1.cpp", "c/2.cpp" }) {
+		sources.push_back(source_path(name));
+		lime::inner_make_parent_directories(sources.back().to_std_string());
+		lime::inner_write_file(sources.back().c_str(), "int x;\n");
+	}
+
+	// NOTE: Wrapper -> members, for the batches only.
+	auto plan = [directory](const std::vector<lime::string> &sources, bool adaptive) {
+		lime::unity_batcher batcher(lime::string(directory) + "/unity");
+		batcher.set_max_batch_size(4);
+		batcher.set_adaptive(adaptive);
+		std::map<std::string, std::vector<std::string>> batches;
+		for (const lime::unity_unit &unit : batcher.plan(sources)) {
+			if (!unit.is_batch) { continue; }
+			std::vector<std::string> &members = batches[unit.source.to_std_string()];
+			for (const lime::string &member : unit.members) { members.push_back(member.to_std_string()); }
+		}
+		return batches;
+	};
+	auto wrapper_mtimes = [](const std::map<std::string, std::vector<std::string>> &batches) {
+		std::vector<long long> result;
+		for (const std::pair<const std::string, std::vector<std::string>> &batch : batches) {
+			struct stat stat_buf;
+			result.push_back(stat(batch.first.c_str(), &stat_buf) == 0 ? stat_buf.st_mtim.tv_sec * 1000000000ll + stat_buf.st_mtim.tv_nsec : -1);
+		}
+		return result;
+	};
+
+	const std::map<std::string, std::vector<std::string>> first = plan(sources, false);
+	size_t batched_count = 0;
+	for (const std::pair<const std::string, std::vector<std::string>> &batch : first) {
+		check(batch.second.size() <= 4, "batches stay within the maximum size");
+		batched_count += batch.second.size();
+	}
+	check(batched_count == sources.size(), "every source is in a batch");
+
+	// NOTE: Same sources in a different order, through a batcher that only has the manifest to go on.
+	std::vector<lime::string> reversed_sources(sources.rbegin(), sources.rend());
+	const std::vector<long long> first_mtimes = wrapper_mtimes(first);
+	check(plan(reversed_sources, false) == first, "replanning the same sources changes nothing");
+	check(wrapper_mtimes(first) == first_mtimes, "unchanged wrappers aren't rewritten");
+
+	// NOTE: A new file only joins a batch, a removed one only leaves its batch, nobody else moves.
+	sources.push_back(source_path("a/6.cpp"));
+	lime::inner_write_file(sources.back().c_str(), "int y;\n");
+	const lime::string removed = source_path("b/2.cpp");
+	sources.erase(std::find(sources.begin(), sources.end(), removed));
+	const std::map<std::string, std::vector<std::string>> second = plan(sources, false);
+	for (const std::pair<const std::string, std::vector<std::string>> &batch : first) {
+		std::vector<std::string> expected_members = batch.second;
+		expected_members.erase(std::remove(expected_members.begin(), expected_members.end(), removed.to_std_string()), expected_members.end());
+		auto replanned = second.find(batch.first);
+		check(replanned != second.end() || expected_members.empty(), "batches survive additions and removals");
+		if (replanned == second.end()) { continue; }
+		check(replanned->second.size() >= expected_members.size() && std::equal(expected_members.begin(), expected_members.end(), replanned->second.begin()),
+		      "existing members keep their batch and their order");
+	}
+
+	// NOTE: Adaptive mode pulls an edited file out into the working set, merging puts it back where it was.
+	// b/1.cpp's batch starts with a/5.cpp, a fresh assignment would put it into the last batch with room, the one with the c/ files.
+	const lime::string edited = source_path("b/1.cpp");
+	const timespec edited_times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+	utimensat(AT_FDCWD, edited.c_str(), edited_times, 0);
+	const std::map<std::string, std::vector<std::string>> third = plan(sources, true);
+	bool edited_batched = false;
+	for (const std::pair<const std::string, std::vector<std::string>> &batch : third) {
+		edited_batched |= std::find(batch.second.begin(), batch.second.end(), edited.to_std_string()) != batch.second.end();
+	}
+	check(!edited_batched, "an edited file leaves its batch in adaptive mode");
+	{
+		lime::unity_batcher batcher(lime::string(directory) + "/unity");
+		batcher.set_max_batch_size(4);
+		batcher.merge_working_set();
+	}
+	// NOTE: The file goes back to the end of its batch, so only the membership is the same as before.
+	std::map<std::string, std::vector<std::string>> merged = plan(sources, false);
+	std::map<std::string, std::vector<std::string>> expected = second;
+	for (std::map<std::string, std::vector<std::string>> *batches : { &merged, &expected }) {
+		for (std::pair<const std::string, std::vector<std::string>> &batch : *batches) { std::sort(batch.second.begin(), batch.second.end()); }
+	}
+	check(merged == expected, "merging the working set puts the file back into its batch");
+
+	lime::inner_remove_tree(directory);
+}
+
+static void test_relative_path() {
+	lime::info("");
+	lime::info("lexical relative paths");
+
+	const char *cases[][3] = {
+		{ "/a/b", "/a/b/c/d.o", "c/d.o" },
+		{ "/a/b", "/a/b", "." },
+		{ "/a/b/", "/a/b", "." },
+		{ "/a/b", "/a/c/d", "../c/d" },
+		{ "/a/b/c", "/x", "../../../x" },
+		{ "/", "/a/b", "a/b" },
+		{ "/a/b", "/", "../.." },
+		{ "/", "/", "." },
+		{ "/a/bc", "/a/b/c", "../b/c" },		// NOTE: Elements are compared whole, "b" isn't a prefix of "bc".
+		{ "/a/b", "/a/b/", "." },
+	};
+	for (const auto &test_case : cases) {
+		const std::string result = lime::inner_relative_path(test_case[0], test_case[1]);
+		check(result == test_case[2], lime::string("from \"") + test_case[0] + "\" to \"" + test_case[1] + "\" gave \"" + lime::string(result) + "\", expected \"" + test_case[2] + '\"');
+	}
+}
 
 int main() {
 	lime::info("testing output methods...");
@@ -57,4 +272,11 @@ int main() {
 	lime::info("filename");
 	lime::info("./bin/../lime_build.h");
 	lime::info(lime::string("./bin/../lime_build.h").get_filename());
+
+	test_find_any_of();
+	test_parse_gtest_report();
+	test_unity_batcher_stability();
+	test_relative_path();
+
+	return failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
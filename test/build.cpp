@@ -4,19 +4,25 @@
 #define BINARY_NAME "bin/test_binary"
 
 void build_and_link_all_cpp_files() noexcept {
-	for (lime::string path : lime::enum_files_recursive(".", "*.cpp")) {
+	lime::include_scanner include_scanner;
+	include_scanner.add_include_directory("src");
+	lime::cutoff_db cutoff_db("bin");
+	lime::listing_cache listing_cache("bin");
+
+	for (const lime::string &path : listing_cache.enum_files_recursive(".", "*.cpp")) {
 		lime::string object_path = "bin" / path.get_relative_path("src").remove_extention().add_extention("o");
-		lime::call_if_out_of_date(object_path, path, []() {
+		lime::call_if_out_of_date(object_path, path, include_scanner, cutoff_db, []() {
 			lime::create_path(object_path.get_parent_folder());
 			lime::exec(COMPILER + "-o " + object_path + ' ' + path);
 		});
 	}
 
-	lime::string object_files;
-	for (lime::string path : lime::enum_files_recursive("bin", "*.o")) {
-		object_files += " " += path;
+	lime::toolchain toolchain = lime::toolchain::probe(COMPILER, "bin");
+	lime::link_target binary(toolchain, BINARY_NAME);
+	for (const lime::directory_walker::entry &entry : lime::directory_walker("bin", "*.o")) {
+		binary.add_object(entry.get_path());
 	}
-	lime::exec(COMPILER + "-o " + BINARY_NAME + object_files);
+	binary.link(cutoff_db);
 }
 
 void clean() noexcept {
@@ -24,8 +30,11 @@ void clean() noexcept {
 }
 
 int main(int argc, const char **argv) noexcept {
+	argc = lime::consume_stats_args(argc, argv);
+	lime::start_spawn_server();
+
 	lime::call_if_self_rebuild_necessary("build.cpp", []() {
-		lime::exec("mv build build.old");
+		lime::move("build", "build.old");
 		lime::exec(COMPILER + "-o build build.cpp");
 	});
 